@@ -0,0 +1,324 @@
+﻿#pragma once
+
+#include "config.h"
+#include <assert.h>
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef JLIB_WINDOWS
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+namespace jlib
+{
+
+//! logical cpus usable by this process and the NUMA node / physical core each belongs to
+struct CpuTopology
+{
+	struct Cpu
+	{
+		int id;
+		int node;
+		int core; // unique across packages, hyper-threads of a core share it
+	};
+
+	std::vector<Cpu> cpus; // ascending id
+	int nodeCount = 1; // highest node id + 1, ids may be sparse so some nodes can have no cpus
+
+	static const CpuTopology& instance() {
+		static CpuTopology topology(load());
+		return topology;
+	}
+
+	std::vector<int> cpusOfNode(int node) const {
+		std::vector<int> ids;
+		for (const auto& cpu : cpus) {
+			if (cpu.node == node) { ids.push_back(cpu.id); }
+		}
+		return ids;
+	}
+
+	//! ids of nodes having at least one usable cpu, ascending
+	std::vector<int> nodes() const {
+		std::vector<int> ids;
+		for (int node = 0; node < nodeCount; node++) {
+			for (const auto& cpu : cpus) {
+				if (cpu.node == node) { ids.push_back(node); break; }
+			}
+		}
+		return ids;
+	}
+
+	int nodeOfCpu(int id) const {
+		for (const auto& cpu : cpus) {
+			if (cpu.id == id) { return cpu.node; }
+		}
+		return -1;
+	}
+
+	//! node by node, hyper-threads of a core next to each other
+	std::vector<int> compactOrder() const {
+		auto sorted = cpus;
+		std::stable_sort(sorted.begin(), sorted.end(), [](const Cpu& a, const Cpu& b) {
+			return a.node != b.node ? a.node < b.node : a.core < b.core;
+		});
+		std::vector<int> ids;
+		for (const auto& cpu : sorted) { ids.push_back(cpu.id); }
+		return ids;
+	}
+
+	//! alternate between nodes, and within a node use every physical core before its siblings
+	std::vector<int> scatterOrder() const {
+		std::vector<std::vector<int>> perNode(nodeCount);
+		for (int node = 0; node < nodeCount; node++) {
+			std::vector<std::pair<int, int>> ranked; // (rank within core, cpu)
+			std::vector<int> seenCores;
+			for (const auto& cpu : cpus) {
+				if (cpu.node != node) { continue; }
+				int rank = static_cast<int>(std::count(seenCores.begin(), seenCores.end(), cpu.core));
+				seenCores.push_back(cpu.core);
+				ranked.emplace_back(rank, cpu.id);
+			}
+			std::stable_sort(ranked.begin(), ranked.end(), [](const std::pair<int, int>& a, const std::pair<int, int>& b) {
+				return a.first < b.first;
+			});
+			for (const auto& r : ranked) { perNode[node].push_back(r.second); }
+		}
+		std::vector<int> ids;
+		for (size_t i = 0; ids.size() < cpus.size(); i++) {
+			for (const auto& node : perNode) {
+				if (i < node.size()) { ids.push_back(node[i]); }
+			}
+		}
+		return ids;
+	}
+
+private:
+#ifdef JLIB_WINDOWS
+	static CpuTopology load() {
+		CpuTopology topology;
+		DWORD_PTR processMask = 0, systemMask = 0;
+		GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask);
+
+		std::vector<int> coreOf(sizeof(DWORD_PTR) * 8, -1);
+		DWORD len = 0;
+		GetLogicalProcessorInformation(nullptr, &len);
+		std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> infos(len / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+		if (!infos.empty() && GetLogicalProcessorInformation(infos.data(), &len)) {
+			int core = 0;
+			for (const auto& info : infos) {
+				if (info.Relationship != RelationProcessorCore) { continue; }
+				for (size_t bit = 0; bit < coreOf.size(); bit++) {
+					if (info.ProcessorMask & (static_cast<ULONG_PTR>(1) << bit)) { coreOf[bit] = core; }
+				}
+				core++;
+			}
+		}
+
+		ULONG highestNode = 0;
+		GetNumaHighestNodeNumber(&highestNode);
+		topology.nodeCount = static_cast<int>(highestNode) + 1;
+		for (int bit = 0; bit < static_cast<int>(coreOf.size()); bit++) {
+			if (!(processMask & (static_cast<DWORD_PTR>(1) << bit))) { continue; }
+			int node = 0;
+			for (ULONG n = 0; n <= highestNode; n++) {
+				ULONGLONG nodeMask = 0;
+				if (GetNumaNodeProcessorMask(static_cast<UCHAR>(n), &nodeMask) && (nodeMask & (1ULL << bit))) {
+					node = static_cast<int>(n);
+					break;
+				}
+			}
+			topology.cpus.push_back(Cpu{ bit, node, coreOf[bit] >= 0 ? coreOf[bit] : bit });
+		}
+		return topology;
+	}
+#else
+	static int readInt(const std::string& path, int defaultValue) {
+		int value = defaultValue;
+		if (FILE* fp = fopen(path.c_str(), "r")) {
+			if (fscanf(fp, "%d", &value) != 1) { value = defaultValue; }
+			fclose(fp);
+		}
+		return value;
+	}
+
+	//! "0-3,8,10-11"
+	static std::vector<int> readCpuList(const std::string& path) {
+		std::vector<int> ids;
+		FILE* fp = fopen(path.c_str(), "r");
+		if (!fp) { return ids; }
+		int first = 0, last = 0;
+		char sep = 0;
+		while (fscanf(fp, "%d", &first) == 1) {
+			last = first;
+			if (fscanf(fp, "%c", &sep) == 1 && sep == '-') {
+				if (fscanf(fp, "%d", &last) != 1) { break; }
+				if (fscanf(fp, "%c", &sep) != 1) { sep = 0; }
+			}
+			for (int i = first; i <= last; i++) { ids.push_back(i); }
+			if (sep != ',') { break; }
+		}
+		fclose(fp);
+		return ids;
+	}
+
+	static CpuTopology load() {
+		CpuTopology topology;
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+			long n = sysconf(_SC_NPROCESSORS_ONLN);
+			for (long i = 0; i < n && i < CPU_SETSIZE; i++) { CPU_SET(i, &set); }
+		}
+
+		// node ids can be sparse, e.g. node0 and node2, empty without NUMA info
+		auto nodes = readCpuList("/sys/devices/system/node/online");
+		if (nodes.empty()) { nodes = readCpuList("/sys/devices/system/node/possible"); }
+		std::vector<int> nodeOf(CPU_SETSIZE, 0);
+		int highestNode = 0;
+		for (int node : nodes) {
+			auto ids = readCpuList("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+			for (int id : ids) {
+				if (id < CPU_SETSIZE) { nodeOf[id] = node; }
+			}
+			highestNode = std::max(highestNode, node);
+		}
+		topology.nodeCount = highestNode + 1;
+
+		for (int id = 0; id < CPU_SETSIZE; id++) {
+			if (!CPU_ISSET(id, &set)) { continue; }
+			std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(id) + "/topology/";
+			int package = readInt(dir + "physical_package_id", 0);
+			int core = readInt(dir + "core_id", id);
+			topology.cpus.push_back(Cpu{ id, nodeOf[id], (package << 16) | (core & 0xFFFF) });
+		}
+		return topology;
+	}
+#endif
+};
+
+//! pin calling thread to cpus, false on failure or if cpus is empty
+inline bool setThreadAffinity(const std::vector<int>& cpus)
+{
+	if (cpus.empty()) { return false; }
+#ifdef JLIB_WINDOWS
+	DWORD_PTR mask = 0;
+	for (int id : cpus) {
+		if (id >= 0 && id < static_cast<int>(sizeof(mask) * 8)) { mask |= static_cast<DWORD_PTR>(1) << id; }
+	}
+	return mask && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#else
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int id : cpus) {
+		if (id >= 0 && id < CPU_SETSIZE) { CPU_SET(id, &set); }
+	}
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#endif
+}
+
+/**
+* @brief Prefer memory of node for allocations made by calling thread from now on.
+* Linux only (set_mempolicy MPOL_PREFERRED), Windows already prefers the node the thread runs on.
+*/
+inline bool preferMemoryNode(int node)
+{
+#if !defined(JLIB_WINDOWS) && defined(SYS_set_mempolicy)
+	if (node < 0 || node >= static_cast<int>(sizeof(unsigned long) * 8)) { return false; }
+	const int MPOL_PREFERRED_ = 1;
+	unsigned long mask = 1UL << node;
+	return syscall(SYS_set_mempolicy, MPOL_PREFERRED_, &mask, sizeof(mask) * 8) == 0;
+#else
+	(void)node;
+	return false;
+#endif
+}
+
+enum class Affinity
+{
+	none,		// leave it to the scheduler
+	compact,	// fill a node, core by core, before moving to the next
+	scatter,	// spread across nodes, then physical cores, then hyper-threads
+	cpuList,	// worker i on ids[i % size]
+	numaNode,	// worker i on all cpus of node ids[i % size], or of the (i % n)th of the n nodes having cpus if ids is empty
+};
+
+/**
+* @brief Where the i-th worker thread of a pool runs, and which node its memory comes from.
+* e.g. pool.setWorkerInitCallback(AffinityPolicy{ Affinity::scatter }.workerInitCallback());
+*/
+struct AffinityPolicy
+{
+	Affinity kind = Affinity::none;
+	std::vector<int> ids = {}; // cpu ids for cpuList, node ids for numaNode
+
+	std::vector<int> cpusFor(int worker) const {
+		const auto& topology = CpuTopology::instance();
+		std::vector<int> order;
+		switch (kind) {
+		case Affinity::compact: order = topology.compactOrder(); break;
+		case Affinity::scatter: order = topology.scatterOrder(); break;
+		case Affinity::cpuList: order = ids; break;
+		case Affinity::numaNode: return topology.cpusOfNode(nodeFor(worker));
+		default: return {};
+		}
+		if (order.empty()) { return {}; }
+		return { order[static_cast<size_t>(worker) % order.size()] };
+	}
+
+	int nodeFor(int worker) const {
+		const auto& topology = CpuTopology::instance();
+		if (kind == Affinity::numaNode) {
+			if (!ids.empty()) { return ids[static_cast<size_t>(worker) % ids.size()]; }
+			auto nodes = topology.nodes();
+			return nodes.empty() ? 0 : nodes[static_cast<size_t>(worker) % nodes.size()];
+		}
+		auto cpus = cpusFor(worker);
+		return cpus.size() == 1 ? topology.nodeOfCpu(cpus[0]) : -1;
+	}
+
+	//! pin calling thread as the worker-th one, and prefer memory of its node
+	bool apply(int worker) const {
+		if (kind == Affinity::none) { return true; }
+		bool ok = setThreadAffinity(cpusFor(worker));
+		if (ok && CpuTopology::instance().nodeCount > 1) {
+			int node = nodeFor(worker);
+			if (node >= 0) { preferMemoryNode(node); }
+		}
+		return ok;
+	}
+
+	/**
+	* @brief Thread init callback applying this policy, workers are numbered by the order they start, then next is called.
+	* Only stable for a fixed set of threads, an elastic ThreadPool should use workerInitCallback().
+	*/
+	std::function<void()> initCallback(std::function<void()> next = nullptr) const {
+		auto counter = std::make_shared<std::atomic<int>>(0);
+		AffinityPolicy policy = *this;
+		return [policy, counter, next]() {
+			policy.apply(counter->fetch_add(1));
+			if (next) { next(); }
+		};
+	}
+
+	//! for ThreadPool::setWorkerInitCallback(), the worker in slot i is pinned as the i-th one, then next is called
+	std::function<void(size_t)> workerInitCallback(std::function<void()> next = nullptr) const {
+		AffinityPolicy policy = *this;
+		return [policy, next](size_t slot) {
+			policy.apply(static_cast<int>(slot));
+			if (next) { next(); }
+		};
+	}
+};
+
+}
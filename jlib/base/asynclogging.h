@@ -0,0 +1,231 @@
+﻿#pragma once
+
+#include "config.h"
+#include "noncopyable.h"
+#include "logstream.h"
+#include "countdownlatch.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <assert.h>
+
+namespace jlib
+{
+
+/**
+* @brief Double buffered asynchronous log backend.
+* Front-end threads only memcpy log lines into currentBuffer_,
+* a dedicated thread hands full buffers to output_ at least every flushInterval seconds.
+* Usage:
+*   AsyncLogging* g_asyncLog = ...;
+*   void asyncOutput(const char* msg, int len) { g_asyncLog->append(msg, len); }
+*   Logger::setOutput(asyncOutput);
+*/
+class AsyncLogging : noncopyable
+{
+public:
+	typedef std::function<void(const char* msg, int len)> OutputFunc;
+	typedef std::function<void()> FlushFunc;
+
+	//! default backend writes to stdout
+	explicit AsyncLogging(int flushInterval = 3, size_t maxBacklogBuffers = 25)
+		: AsyncLogging([](const char* msg, int len) { fwrite(msg, 1, len, stdout); },
+					   []() { fflush(stdout); },
+					   flushInterval, maxBacklogBuffers)
+	{}
+
+	/**
+	* @param output called on the backend thread only
+	* @param flush called on the backend thread only
+	* @param flushInterval max seconds a log line stays in memory
+	* @param maxBacklogBuffers pending full buffers beyond this are dropped
+	*/
+	AsyncLogging(OutputFunc output, FlushFunc flush, int flushInterval = 3, size_t maxBacklogBuffers = 25)
+		: output_(std::move(output))
+		, flush_(std::move(flush))
+		, flushInterval_(flushInterval)
+		, maxBacklogBuffers_(maxBacklogBuffers < 2 ? 2 : maxBacklogBuffers)
+		, running_(false)
+		, latch_(1)
+		, mutex_()
+		, cond_()
+		, currentBuffer_(new Buffer())
+		, nextBuffer_(new Buffer())
+		, buffers_()
+		, droppedBuffers_(0)
+		, droppedBytes_(0)
+	{
+		currentBuffer_->bzero();
+		nextBuffer_->bzero();
+		buffers_.reserve(16);
+	}
+
+	~AsyncLogging() {
+		if (running_) {
+			stop();
+		}
+	}
+
+	//! thread safe, called by front-end threads
+	void append(const char* logline, int len) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (currentBuffer_->avail() > len) {
+			currentBuffer_->append(logline, len);
+		} else {
+			buffers_.push_back(std::move(currentBuffer_));
+			if (nextBuffer_) {
+				currentBuffer_ = std::move(nextBuffer_);
+			} else {
+				currentBuffer_.reset(new Buffer()); // rarely happens
+			}
+			currentBuffer_->append(logline, len);
+			cond_.notify_one();
+		}
+	}
+
+	void start() {
+		running_ = true;
+		thread_ = std::thread(&AsyncLogging::threadFunc, this);
+		latch_.wait();
+	}
+
+	void stop() {
+		{
+			// under the lock, or backend may miss the wakeup between its check and wait
+			std::lock_guard<std::mutex> lock(mutex_);
+			running_ = false;
+			cond_.notify_one();
+		}
+		if (thread_.joinable()) {
+			thread_.join();
+		}
+	}
+
+	//! count of full buffers dropped because backend could not keep up
+	uint64_t droppedBuffers() const { return droppedBuffers_.load(std::memory_order_relaxed); }
+	//! bytes of log lines dropped because backend could not keep up
+	uint64_t droppedBytes() const { return droppedBytes_.load(std::memory_order_relaxed); }
+
+private:
+	typedef detail::FixedBuffer<detail::LARGE_BUFFER> Buffer;
+	typedef std::unique_ptr<Buffer> BufferPtr;
+	typedef std::vector<BufferPtr> BufferVector;
+
+	void threadFunc() {
+		assert(running_ == true);
+		latch_.countDown();
+		BufferPtr newBuffer1(new Buffer());
+		BufferPtr newBuffer2(new Buffer());
+		newBuffer1->bzero();
+		newBuffer2->bzero();
+		BufferVector buffersToWrite;
+		buffersToWrite.reserve(16);
+
+		while (running_) {
+			assert(newBuffer1 && newBuffer1->length() == 0);
+			assert(newBuffer2 && newBuffer2->length() == 0);
+			assert(buffersToWrite.empty());
+
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				if (buffers_.empty() && running_) { // unusual usage!
+					cond_.wait_for(lock, std::chrono::seconds(flushInterval_));
+				}
+				buffers_.push_back(std::move(currentBuffer_));
+				currentBuffer_ = std::move(newBuffer1);
+				buffersToWrite.swap(buffers_);
+				if (!nextBuffer_) {
+					nextBuffer_ = std::move(newBuffer2);
+				}
+			}
+
+			assert(!buffersToWrite.empty());
+
+			if (buffersToWrite.size() > maxBacklogBuffers_) {
+				dropBacklog(buffersToWrite);
+			}
+
+			for (const auto& buffer : buffersToWrite) {
+				if (buffer->length() > 0) {
+					output_(buffer->data(), buffer->length());
+				}
+			}
+
+			// keep 2 buffers for reuse, drop the others
+			if (buffersToWrite.size() > 2) {
+				buffersToWrite.resize(2);
+			}
+
+			if (!newBuffer1) {
+				assert(!buffersToWrite.empty());
+				newBuffer1 = std::move(buffersToWrite.back());
+				buffersToWrite.pop_back();
+				newBuffer1->reset();
+			}
+
+			if (!newBuffer2) {
+				assert(!buffersToWrite.empty());
+				newBuffer2 = std::move(buffersToWrite.back());
+				buffersToWrite.pop_back();
+				newBuffer2->reset();
+			}
+
+			buffersToWrite.clear();
+			flush_();
+		}
+
+		// flush what front-end threads appended before stop()
+		std::lock_guard<std::mutex> lock(mutex_);
+		for (const auto& buffer : buffers_) {
+			output_(buffer->data(), buffer->length());
+		}
+		buffers_.clear();
+		if (currentBuffer_->length() > 0) {
+			output_(currentBuffer_->data(), currentBuffer_->length());
+			currentBuffer_->reset();
+		}
+		flush_();
+	}
+
+	//! keep the oldest 2 buffers, count and discard the rest
+	void dropBacklog(BufferVector& buffersToWrite) {
+		uint64_t bytes = 0;
+		for (size_t i = 2; i < buffersToWrite.size(); i++) {
+			bytes += buffersToWrite[i]->length();
+		}
+		size_t dropped = buffersToWrite.size() - 2;
+		droppedBuffers_.fetch_add(dropped, std::memory_order_relaxed);
+		droppedBytes_.fetch_add(bytes, std::memory_order_relaxed);
+
+		char buf[256];
+		int len = snprintf(buf, sizeof(buf), "Dropped log messages, %zu larger buffers, %llu bytes, total dropped %llu buffers\n",
+						   dropped, static_cast<unsigned long long>(bytes), static_cast<unsigned long long>(droppedBuffers()));
+		fputs(buf, stderr);
+		output_(buf, len);
+		buffersToWrite.erase(buffersToWrite.begin() + 2, buffersToWrite.end());
+	}
+
+	OutputFunc output_;
+	FlushFunc flush_;
+	const int flushInterval_;
+	const size_t maxBacklogBuffers_;
+	std::atomic<bool> running_;
+	std::thread thread_;
+	CountDownLatch latch_;
+	std::mutex mutex_;
+	std::condition_variable cond_;
+	BufferPtr currentBuffer_;
+	BufferPtr nextBuffer_;
+	BufferVector buffers_;
+	std::atomic<uint64_t> droppedBuffers_;
+	std::atomic<uint64_t> droppedBytes_;
+};
+
+} // namespace jlib
@@ -0,0 +1,569 @@
+﻿#pragma once
+
+#include "config.h"
+#include "noncopyable.h"
+#include "logging.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+* Binary (deferred formatting) logging.
+*
+* BLOG_* statements only record the call site id, timestamp, tid and raw argument bytes
+* into a per-thread ring, text formatting is done later by:
+*   1. a background thread: BinaryLogging::instance().start(), lines go to Logger::setOutput() as usual;
+*   2. an offline decoder: BinaryLogging::instance().start(fp) writes raw records to fp,
+*      BinaryLogging::decode(fp) replays them through Logger later.
+* Both render text identical to the LOG_* macros since they replay through Logger.
+*
+* Define JLIB_LOG_BINARY before including this file to make LOG_TRACE ~ LOG_ERROR binary too.
+* LOG_FATAL, LOG_SYSERR and LOG_SYSFATAL always format immediately.
+*/
+
+namespace jlib
+{
+
+namespace detail
+{
+
+//! static description of a BLOG_* statement, recorded once per call site
+struct LogSite
+{
+	Logger::LogLevel level;
+	Logger::SourceFile file;
+	int line;
+	const char* func; // only for TRACE and DEBUG, as Logger does
+};
+
+enum class BinaryArg : uint8_t {
+	Bool,
+	Char,
+	Int64,
+	UInt64,
+	Double,
+	Pointer,
+	String, // uint32_t length + bytes
+};
+
+/*
+* record layout, 8 byte aligned in ring:
+*   uint32_t size; // header included, padding excluded
+*   uint32_t siteId;
+*   int64_t microSecondsSinceEpoch;
+*   uint64_t tid;
+*   args: BinaryArg tag + payload ...
+*/
+static constexpr uint32_t BINARY_RECORD_HEADER = 24;
+static constexpr uint32_t BINARY_RING_WRAP = 0xFFFFFFFF;
+
+inline size_t align8(size_t n) { return (n + 7) & ~static_cast<size_t>(7); }
+
+//! single producer (owner thread), single consumer (BinaryLogging backend)
+class BinaryRing : noncopyable
+{
+public:
+	explicit BinaryRing(size_t capacity)
+		: buf_(new char[capacity])
+		, capacity_(capacity)
+		, head_(0)
+		, tail_(0)
+		, closed_(false)
+	{
+		assert(capacity % 8 == 0);
+	}
+
+	//! producer: copy a whole record into ring, false if it is full
+	bool push(const char* record, uint32_t size) {
+		size_t n = align8(size);
+		size_t h = head_.load(std::memory_order_relaxed);
+		size_t t = tail_.load(std::memory_order_acquire);
+		size_t off = h % capacity_;
+		if (off + n > capacity_) { // doesn't fit before the end, wrap
+			size_t pad = capacity_ - off;
+			if (h + pad + n - t > capacity_) { return false; }
+			memcpy(buf_.get() + off, &BINARY_RING_WRAP, sizeof(uint32_t));
+			h += pad;
+			off = 0;
+		} else if (h + n - t > capacity_) {
+			return false;
+		}
+		memcpy(buf_.get() + off, record, size);
+		head_.store(h + n, std::memory_order_release);
+		return true;
+	}
+
+	//! consumer: call f(record, size) for each record available now
+	template <typename F>
+	size_t consume(F&& f) {
+		size_t t = tail_.load(std::memory_order_relaxed);
+		size_t h = head_.load(std::memory_order_acquire);
+		size_t count = 0;
+		while (t < h) {
+			size_t off = t % capacity_;
+			uint32_t size;
+			memcpy(&size, buf_.get() + off, sizeof(size));
+			if (size == BINARY_RING_WRAP) {
+				t += capacity_ - off;
+				continue;
+			}
+			f(buf_.get() + off, size);
+			t += align8(size);
+			count++;
+		}
+		tail_.store(t, std::memory_order_release);
+		return count;
+	}
+
+	size_t capacity() const { return capacity_; }
+	//! owner thread exited, ring can be removed once empty
+	void close() { closed_ = true; }
+	bool closed() const { return closed_; }
+	bool empty() const { return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire); }
+	//! producer: bytes in use, may be stale
+	size_t used() const { return head_.load(std::memory_order_relaxed) - tail_.load(std::memory_order_relaxed); }
+
+private:
+	std::unique_ptr<char[]> buf_;
+	const size_t capacity_;
+	alignas(64) std::atomic<size_t> head_;
+	alignas(64) std::atomic<size_t> tail_;
+	std::atomic<bool> closed_;
+};
+
+//! raw file frames
+enum class BinaryFrame : uint32_t {
+	Site = 1,	// uint32_t id, int32_t level, int32_t line, uint32_t fileLen, uint32_t funcLen, file, func
+	Record = 2,	// record as in ring
+};
+
+template <typename T>
+inline T readAs(const char*& p) {
+	T v;
+	memcpy(&v, p, sizeof(v));
+	p += sizeof(v);
+	return v;
+}
+
+//! replay args of record into stream, identical to streaming them into LogStream directly
+inline void decodeArgs(const char* p, const char* end, LogStream& stream) {
+	while (p < end) {
+		switch (static_cast<BinaryArg>(*p++)) {
+		case BinaryArg::Bool: stream << (readAs<uint8_t>(p) != 0); break;
+		case BinaryArg::Char: stream << readAs<char>(p); break;
+		case BinaryArg::Int64: stream << readAs<int64_t>(p); break;
+		case BinaryArg::UInt64: stream << readAs<uint64_t>(p); break;
+		case BinaryArg::Double: stream << readAs<double>(p); break;
+		case BinaryArg::Pointer: stream << reinterpret_cast<const void*>(readAs<uintptr_t>(p)); break;
+		case BinaryArg::String: {
+			uint32_t len = readAs<uint32_t>(p);
+			stream.append(p, static_cast<int>(len));
+			p += len;
+			break;
+		}
+		default: assert(false && "corrupted binary log record"); return;
+		}
+	}
+}
+
+} // namespace detail
+
+
+class BinaryLogging : noncopyable
+{
+public:
+	typedef detail::LogSite LogSite;
+
+	static constexpr size_t DEFAULT_RING_SIZE = 1024 * 1024;
+
+	static BinaryLogging& instance() {
+		static BinaryLogging logging;
+		return logging;
+	}
+
+	~BinaryLogging() {
+		if (running_) {
+			stop();
+		}
+	}
+
+	//! must be called before the first BLOG_* of any thread
+	void setRingSize(size_t bytes) { ringSize_ = detail::align8(bytes); }
+
+	//! decode in background, lines go to Logger output
+	void start(int flushIntervalMs = 100) {
+		startImpl(nullptr, flushIntervalMs);
+	}
+
+	//! write raw records to fp for offline decoding with decode()
+	void start(FILE* fp, int flushIntervalMs = 100) {
+		startImpl(fp, flushIntervalMs);
+	}
+
+	void stop() {
+		running_ = false;
+		cond_.notify_one();
+		if (thread_.joinable()) {
+			thread_.join();
+		}
+	}
+
+	//! records dropped because a thread's ring was full
+	uint64_t droppedRecords() const { return dropped_.load(std::memory_order_relaxed); }
+
+	//! called once per call site
+	uint32_t registerSite(const LogSite& site) {
+		std::lock_guard<std::mutex> lock(sitesMutex_);
+		sites_.push_back(site);
+		return static_cast<uint32_t>(sites_.size() - 1);
+	}
+
+	//! producer side, record must be a complete record
+	void push(const char* record, uint32_t size) {
+		auto& ring = threadRing();
+		if (JLIB_UNLIKELY(!ring.push(record, size))) {
+			dropped_.fetch_add(1, std::memory_order_relaxed);
+		}
+		if (JLIB_UNLIKELY(ring.used() > ring.capacity() / 2)) {
+			cond_.notify_one(); // don't wait for flush interval
+		}
+	}
+
+	//! replay a raw file written by start(fp) through Logger, returns records decoded
+	static size_t decode(FILE* fp) {
+		struct DecodedSite {
+			LogSite site;
+			std::string names; // "file\0func\0", site points into it
+		};
+		std::vector<std::unique_ptr<DecodedSite>> sites;
+		std::vector<char> frame;
+		size_t count = 0;
+		uint32_t header[2]; // size, type
+		while (fread(header, sizeof(header), 1, fp) == 1) {
+			if (header[0] < sizeof(header)) { break; }
+			frame.resize(header[0] - sizeof(header));
+			if (!frame.empty() && fread(frame.data(), frame.size(), 1, fp) != 1) { break; }
+			const char* p = frame.data();
+			if (header[1] == static_cast<uint32_t>(detail::BinaryFrame::Site)) {
+				uint32_t id = detail::readAs<uint32_t>(p);
+				int32_t level = detail::readAs<int32_t>(p);
+				int32_t line = detail::readAs<int32_t>(p);
+				uint32_t fileLen = detail::readAs<uint32_t>(p);
+				uint32_t funcLen = detail::readAs<uint32_t>(p);
+				if (sites.size() <= id) { sites.resize(id + 1); }
+				std::unique_ptr<DecodedSite> decoded(new DecodedSite{ LogSite{ static_cast<Logger::LogLevel>(level), Logger::SourceFile(""), line, nullptr }, {} });
+				decoded->names.assign(p, fileLen + 1 + funcLen);
+				decoded->names.push_back('\0');
+				decoded->site.file = Logger::SourceFile(decoded->names.c_str());
+				decoded->site.func = funcLen ? decoded->names.c_str() + fileLen + 1 : nullptr;
+				sites[id] = std::move(decoded);
+			} else if (header[1] == static_cast<uint32_t>(detail::BinaryFrame::Record)) {
+				uint32_t id;
+				memcpy(&id, p + 4, sizeof(id));
+				if (id < sites.size() && sites[id]) {
+					replay(sites[id]->site, p, static_cast<uint32_t>(frame.size()));
+					count++;
+				}
+			}
+		}
+		return count;
+	}
+
+private:
+	BinaryLogging()
+		: ringSize_(DEFAULT_RING_SIZE)
+		, running_(false)
+		, rawFile_(nullptr)
+		, flushIntervalMs_(100)
+		, sitesWritten_(0)
+		, dropped_(0)
+	{}
+
+	//! closes the ring when owner thread exits
+	struct RingHolder
+	{
+		std::shared_ptr<detail::BinaryRing> ring;
+		~RingHolder() { if (ring) { ring->close(); } }
+	};
+
+	detail::BinaryRing& threadRing() {
+		thread_local RingHolder holder;
+		if (JLIB_UNLIKELY(!holder.ring)) {
+			holder.ring = std::make_shared<detail::BinaryRing>(ringSize_);
+			std::lock_guard<std::mutex> lock(ringsMutex_);
+			rings_.push_back(holder.ring);
+		}
+		return *holder.ring;
+	}
+
+	void startImpl(FILE* fp, int flushIntervalMs) {
+		assert(!running_);
+		rawFile_ = fp;
+		sitesWritten_ = 0; // a new raw file needs every site frame again
+		flushIntervalMs_ = flushIntervalMs;
+		running_ = true;
+		thread_ = std::thread(&BinaryLogging::threadFunc, this);
+	}
+
+	void threadFunc() {
+		std::vector<std::shared_ptr<detail::BinaryRing>> rings;
+		while (running_) {
+			{
+				std::unique_lock<std::mutex> lock(ringsMutex_);
+				cond_.wait_for(lock, std::chrono::milliseconds(flushIntervalMs_));
+				rings = rings_;
+			}
+			drain(rings);
+		}
+		{
+			std::lock_guard<std::mutex> lock(ringsMutex_);
+			rings = rings_;
+		}
+		drain(rings);
+	}
+
+	void drain(std::vector<std::shared_ptr<detail::BinaryRing>>& rings) {
+		if (rawFile_) {
+			writeSites();
+		}
+
+		bool removeClosed = false;
+		for (auto& ring : rings) {
+			bool closed = ring->closed(); // read before consuming, owner won't push after close
+			ring->consume([this](const char* record, uint32_t size) {
+				if (rawFile_) {
+					writeFrame(detail::BinaryFrame::Record, record, size);
+				} else {
+					uint32_t id;
+					memcpy(&id, record + 4, sizeof(id));
+					if (JLIB_UNLIKELY(id >= backendSites_.size())) {
+						std::lock_guard<std::mutex> lock(sitesMutex_);
+						backendSites_ = sites_;
+					}
+					replay(backendSites_[id], record, size);
+				}
+			});
+			removeClosed |= closed;
+		}
+
+		if (rawFile_) {
+			fflush(rawFile_);
+		} else {
+			Logger::flush();
+		}
+
+		if (removeClosed) {
+			std::lock_guard<std::mutex> lock(ringsMutex_);
+			for (auto iter = rings_.begin(); iter != rings_.end();) {
+				if ((*iter)->closed() && (*iter)->empty()) {
+					iter = rings_.erase(iter);
+				} else {
+					++iter;
+				}
+			}
+		}
+	}
+
+	static void replay(const LogSite& site, const char* record, uint32_t size) {
+		const char* p = record + 8;
+		int64_t micros = detail::readAs<int64_t>(p);
+		uint64_t tid = detail::readAs<uint64_t>(p);
+		Logger logger(site.file, site.line, site.level, site.func, Timestamp(std::chrono::microseconds(micros)), tid);
+		detail::decodeArgs(p, record + size, logger.stream());
+	}
+
+	void writeSites() {
+		std::vector<LogSite> sites;
+		{
+			std::lock_guard<std::mutex> lock(sitesMutex_);
+			sites.assign(sites_.begin() + sitesWritten_, sites_.end());
+		}
+		std::string frame;
+		for (const auto& site : sites) {
+			uint32_t id = static_cast<uint32_t>(sitesWritten_++);
+			int32_t level = site.level;
+			int32_t line = site.line;
+			uint32_t fileLen = static_cast<uint32_t>(site.file.size_);
+			uint32_t funcLen = site.func ? static_cast<uint32_t>(strlen(site.func)) : 0;
+			frame.clear();
+			frame.append(reinterpret_cast<const char*>(&id), sizeof(id));
+			frame.append(reinterpret_cast<const char*>(&level), sizeof(level));
+			frame.append(reinterpret_cast<const char*>(&line), sizeof(line));
+			frame.append(reinterpret_cast<const char*>(&fileLen), sizeof(fileLen));
+			frame.append(reinterpret_cast<const char*>(&funcLen), sizeof(funcLen));
+			frame.append(site.file.data_, fileLen);
+			frame.push_back('\0');
+			if (site.func) { frame.append(site.func, funcLen); }
+			writeFrame(detail::BinaryFrame::Site, frame.data(), static_cast<uint32_t>(frame.size()));
+		}
+	}
+
+	void writeFrame(detail::BinaryFrame type, const char* data, uint32_t size) {
+		uint32_t header[2] = { size + static_cast<uint32_t>(sizeof(uint32_t) * 2), static_cast<uint32_t>(type) };
+		fwrite(header, sizeof(header), 1, rawFile_);
+		fwrite(data, 1, size, rawFile_);
+	}
+
+	size_t ringSize_;
+	std::atomic<bool> running_;
+	FILE* rawFile_;
+	int flushIntervalMs_;
+	std::thread thread_;
+	std::mutex ringsMutex_;
+	std::condition_variable cond_;
+	std::vector<std::shared_ptr<detail::BinaryRing>> rings_;
+	std::mutex sitesMutex_;
+	std::vector<LogSite> sites_;
+	std::vector<LogSite> backendSites_; // copy of sites_ used by backend without locking
+	size_t sitesWritten_;
+	std::atomic<uint64_t> dropped_;
+};
+
+
+/**
+* @brief Temporary object of a BLOG_* statement, encodes args and pushes the record on destruction.
+* Types without a binary encoding are formatted through LogStream immediately and recorded as string.
+*/
+class BinaryLogger : noncopyable
+{
+	typedef BinaryLogger self;
+
+public:
+	explicit BinaryLogger(uint32_t siteId) {
+		char header[detail::BINARY_RECORD_HEADER];
+		char* p = header;
+		uint32_t size = 0;
+		int64_t micros = nowTimestamp().time_since_epoch().count();
+		uint64_t tid = CurrentThread::tid();
+		memcpy(p, &size, 4); p += 4;
+		memcpy(p, &siteId, 4); p += 4;
+		memcpy(p, &micros, 8); p += 8;
+		memcpy(p, &tid, 8);
+		buffer_.append(header, sizeof(header));
+	}
+
+	~BinaryLogger() {
+		uint32_t size = static_cast<uint32_t>(buffer_.length());
+		memcpy(buffer_.current() - size, &size, sizeof(size));
+		BinaryLogging::instance().push(buffer_.data(), size);
+	}
+
+	self& stream() { return *this; }
+
+	self& operator<<(bool v) { return put(detail::BinaryArg::Bool, static_cast<uint8_t>(v)); }
+	self& operator<<(char v) { return put(detail::BinaryArg::Char, v); }
+	self& operator<<(short v) { return put(detail::BinaryArg::Int64, static_cast<int64_t>(v)); }
+	self& operator<<(unsigned short v) { return put(detail::BinaryArg::UInt64, static_cast<uint64_t>(v)); }
+	self& operator<<(int v) { return put(detail::BinaryArg::Int64, static_cast<int64_t>(v)); }
+	self& operator<<(unsigned int v) { return put(detail::BinaryArg::UInt64, static_cast<uint64_t>(v)); }
+	self& operator<<(long v) { return put(detail::BinaryArg::Int64, static_cast<int64_t>(v)); }
+	self& operator<<(unsigned long v) { return put(detail::BinaryArg::UInt64, static_cast<uint64_t>(v)); }
+	self& operator<<(long long v) { return put(detail::BinaryArg::Int64, static_cast<int64_t>(v)); }
+	self& operator<<(unsigned long long v) { return put(detail::BinaryArg::UInt64, static_cast<uint64_t>(v)); }
+	self& operator<<(float v) { return put(detail::BinaryArg::Double, static_cast<double>(v)); }
+	self& operator<<(double v) { return put(detail::BinaryArg::Double, v); }
+	self& operator<<(const void* p) { return put(detail::BinaryArg::Pointer, reinterpret_cast<uintptr_t>(p)); }
+
+	self& operator<<(const char* str) {
+		if (str) { return putString(str, strlen(str)); }
+		return putString("(null)", 6);
+	}
+	self& operator<<(const unsigned char* str) { return operator<<(reinterpret_cast<const char*>(str)); }
+	self& operator<<(const std::string& v) { return putString(v.data(), v.size()); }
+	self& operator<<(const StringPiece& v) { return putString(v.data(), v.size()); }
+	self& operator<<(const Format& fmt) { return putString(fmt.data(), fmt.length()); }
+
+	//! anything else LogStream knows how to print, formatted now
+	template <typename T>
+	self& operator<<(const T& v) {
+		LogStream stream;
+		stream << v;
+		return putString(stream.buffer().data(), stream.buffer().length());
+	}
+
+private:
+	template <typename T>
+	self& put(detail::BinaryArg tag, T v) {
+		char buf[1 + sizeof(T)];
+		buf[0] = static_cast<char>(tag);
+		memcpy(buf + 1, &v, sizeof(T));
+		buffer_.append(buf, sizeof(buf));
+		return *this;
+	}
+
+	self& putString(const char* str, size_t len) {
+		char buf[1 + sizeof(uint32_t)];
+		uint32_t len32 = static_cast<uint32_t>(len);
+		buf[0] = static_cast<char>(detail::BinaryArg::String);
+		memcpy(buf + 1, &len32, sizeof(len32));
+		buffer_.append(buf, sizeof(buf));
+		buffer_.append(str, len);
+		return *this;
+	}
+
+	detail::LogBuffer buffer_; // staging, borrows the thread local log storage
+};
+
+
+/******** binary log micros *********/
+
+#define JLIB_BLOG_SITE(level, func) [](const char* f) -> uint32_t { \
+	static const uint32_t id = jlib::BinaryLogging::instance().registerSite( \
+		jlib::detail::LogSite{ jlib::Logger::LogLevel::level, jlib::Logger::SourceFile(__FILE__), __LINE__, (func) }); \
+	(void)f; return id; }(__func__)
+
+#if JLIB_MIN_LOG_LEVEL <= 0
+#define BLOG_TRACE if (JLIB_UNLIKELY(jlib::Logger::logLevel() <= jlib::Logger::LogLevel::LOGLEVEL_TRACE)) JLIB_ATTR_UNLIKELY \
+	jlib::BinaryLogger(JLIB_BLOG_SITE(LOGLEVEL_TRACE, f)).stream()
+#else
+#define BLOG_TRACE JLIB_LOG_DISCARD(LOGLEVEL_TRACE)
+#endif
+
+#if JLIB_MIN_LOG_LEVEL <= 1
+#define BLOG_DEBUG if (JLIB_UNLIKELY(jlib::Logger::logLevel() <= jlib::Logger::LogLevel::LOGLEVEL_DEBUG)) JLIB_ATTR_UNLIKELY \
+	jlib::BinaryLogger(JLIB_BLOG_SITE(LOGLEVEL_DEBUG, f)).stream()
+#else
+#define BLOG_DEBUG JLIB_LOG_DISCARD(LOGLEVEL_DEBUG)
+#endif
+
+#if JLIB_MIN_LOG_LEVEL <= 2
+#define BLOG_INFO if (JLIB_LIKELY(jlib::Logger::logLevel() <= jlib::Logger::LogLevel::LOGLEVEL_INFO)) \
+	jlib::BinaryLogger(JLIB_BLOG_SITE(LOGLEVEL_INFO, nullptr)).stream()
+#else
+#define BLOG_INFO JLIB_LOG_DISCARD(LOGLEVEL_INFO)
+#endif
+
+#if JLIB_MIN_LOG_LEVEL <= 3
+#define BLOG_WARN jlib::BinaryLogger(JLIB_BLOG_SITE(LOGLEVEL_WARN, nullptr)).stream()
+#else
+#define BLOG_WARN JLIB_LOG_DISCARD(LOGLEVEL_WARN)
+#endif
+
+#if JLIB_MIN_LOG_LEVEL <= 4
+#define BLOG_ERROR jlib::BinaryLogger(JLIB_BLOG_SITE(LOGLEVEL_ERROR, nullptr)).stream()
+#else
+#define BLOG_ERROR JLIB_LOG_DISCARD(LOGLEVEL_ERROR)
+#endif
+
+#ifdef JLIB_LOG_BINARY
+#undef LOG_TRACE
+#undef LOG_DEBUG
+#undef LOG_INFO
+#undef LOG_WARN
+#undef LOG_ERROR
+#define LOG_TRACE BLOG_TRACE
+#define LOG_DEBUG BLOG_DEBUG
+#define LOG_INFO BLOG_INFO
+#define LOG_WARN BLOG_WARN
+#define LOG_ERROR BLOG_ERROR
+#endif
+
+} // namespace jlib
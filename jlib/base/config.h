@@ -32,3 +32,33 @@
 #  define ENABLE_EBO
 
 #endif // JLIB_WINDOWS
+
+
+// branch prediction hints
+#ifdef __GNUC__
+#  define JLIB_LIKELY(x) __builtin_expect(!!(x), 1)
+#  define JLIB_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#else
+#  define JLIB_LIKELY(x) (x)
+#  define JLIB_UNLIKELY(x) (x)
+#endif
+
+// spin-wait hint
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#  include <intrin.h>
+#  define JLIB_CPU_RELAX() _mm_pause()
+#elif defined(__i386__) || defined(__x86_64__)
+#  define JLIB_CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+#  define JLIB_CPU_RELAX() __asm__ __volatile__("yield")
+#else
+#  define JLIB_CPU_RELAX() ((void)0)
+#endif
+
+#if (defined(_MSVC_LANG) && _MSVC_LANG >= 202002L) || __cplusplus >= 202002L
+#  define JLIB_ATTR_LIKELY [[likely]]
+#  define JLIB_ATTR_UNLIKELY [[unlikely]]
+#else
+#  define JLIB_ATTR_LIKELY
+#  define JLIB_ATTR_UNLIKELY
+#endif
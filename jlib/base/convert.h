@@ -0,0 +1,134 @@
+﻿#pragma once
+
+#include "config.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+
+#ifdef JLIB_WINDOWS
+#include <intrin.h>
+#endif
+
+namespace jlib
+{
+
+namespace detail
+{
+
+static constexpr char digitsHex[] = "0123456789ABCDEF";
+static_assert(sizeof(digitsHex) == 17, "wrong number of digitsHex");
+
+//! "00" "01" ... "99"
+static constexpr char digits2[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+static_assert(sizeof(digits2) == 201, "wrong number of digits2");
+
+//! count of decimal digits of v, 1 for 0
+template <typename U>
+inline int countDigits(U v)
+{
+	static_assert(std::is_unsigned<U>::value, "U must be unsigned");
+	int n = 1;
+	for (;;) {
+		if (v < 10) { return n; }
+		if (v < 100) { return n + 1; }
+		if (v < 1000) { return n + 2; }
+		if (v < 10000) { return n + 3; }
+		v /= 10000u;
+		n += 4;
+	}
+}
+
+//! count of hex digits of v, 1 for 0
+inline int countHexDigits(uint64_t v)
+{
+	v |= 1; // 0 has 1 digit, also keeps clz well defined
+#ifdef JLIB_WINDOWS
+	unsigned long idx = 0;
+#  if defined(_WIN64)
+	_BitScanReverse64(&idx, v);
+#  else
+	if (v >> 32) {
+		_BitScanReverse(&idx, static_cast<unsigned long>(v >> 32));
+		idx += 32;
+	} else {
+		_BitScanReverse(&idx, static_cast<unsigned long>(v));
+	}
+#  endif
+	int bits = static_cast<int>(idx) + 1;
+#else
+	int bits = 64 - __builtin_clzll(v);
+#endif
+	return (bits + 3) >> 2;
+}
+
+/**
+* @brief Write decimal value to buf, null terminated.
+* Digit count is computed first, then digits are written two at a time
+* from the end using a lookup table, no reverse pass needed.
+* @note buf must hold at least 21 bytes for 64 bit values
+* @return length, excluding null terminator
+*/
+template <typename T>
+inline size_t convert(char buf[], T value)
+{
+	typedef typename std::make_unsigned<T>::type U;
+	U u = static_cast<U>(value);
+	char* p = buf;
+	if (value < 0) {
+		*p++ = '-';
+		u = static_cast<U>(0 - u);
+	}
+
+	p += countDigits(u);
+	*p = '\0';
+	char* end = p;
+
+	while (u >= 100) {
+		unsigned idx = static_cast<unsigned>(u % 100) * 2;
+		u /= 100;
+		*--p = digits2[idx + 1];
+		*--p = digits2[idx];
+	}
+
+	if (u < 10) {
+		*--p = static_cast<char>('0' + u);
+	} else {
+		unsigned idx = static_cast<unsigned>(u) * 2;
+		*--p = digits2[idx + 1];
+		*--p = digits2[idx];
+	}
+
+	return end - buf;
+}
+
+/**
+* @brief Write upper case hex value to buf without "0x", null terminated.
+* Branchless per digit, digit count comes from a bit scan.
+* @note buf must hold at least 17 bytes
+* @return length, excluding null terminator
+*/
+inline size_t convertHex(char buf[], uintptr_t value)
+{
+	int len = countHexDigits(value);
+	char* p = buf + len;
+	*p = '\0';
+	for (int i = 0; i < len; i++) {
+		*--p = digitsHex[value & 0xF];
+		value >>= 4;
+	}
+	return len;
+}
+
+} // namespace detail
+
+} // namespace jlib
@@ -1,6 +1,9 @@
-﻿#include "config.h"
+﻿#pragma once
+
+#include "config.h"
 #include "noncopyable.h"
 #include <mutex>
+#include <condition_variable>
 
 namespace jlib
 {
@@ -8,6 +8,7 @@
 #include <sys/stat.h>
 #include <assert.h>
 #include <algorithm>
+#include <string.h>
 #include "cast.h"
 #include "noncopyable.h"
 #include "stringpiece.h"
@@ -23,18 +24,18 @@ class ReadSmallFile : noncopyable
 {
 public:
 	ReadSmallFile(StringArg filename)
-		: fd_(::fopen(filename.c_str(), "r"))
+		: fp_(::fopen(filename.c_str(), "rb"))
 		, err_(0)
 	{
 		buf_[0] = '\0';
-		if (fd_ < 0) {
+		if (!fp_) {
 			err_ = errno;
 		}
 	}
 
 	~ReadSmallFile() {
-		if (fd_ >= 0) {
-			::fclose(fd_);
+		if (fp_) {
+			::fclose(fp_);
 		}
 	}
 
@@ -43,11 +44,11 @@ public:
 		static_assert(sizeof(off_t) == 8, "sizeof(off_t) != 8");
 		assert(content);
 		int err = err_;
-		if (fd_ >= 0) {
+		if (fp_) {
 			content->clear();
 			if (fileSize) {
 				struct stat statbuf;
-				if (::fstat(fd_, &statbuf) == 0) {
+				if (::fstat(fileno(fp_), &statbuf) == 0) {
 					if (S_IFREG & (statbuf.st_mode)) {
 						*fileSize = statbuf.st_size;
 						content->reserve(static_cast<int>(std::min(implicit_cast<int64_t>(maxSize), *fileSize)));
@@ -63,13 +64,13 @@ public:
 						*createTime = statbuf.st_ctime;
 					}
 				} else {
-					err = errno
+					err = errno;
 				}
 			}
 
 			while (content->size() < implicit_cast<size_t>(maxSize)) {
 				size_t toRead = std::min(implicit_cast<size_t>(maxSize) - content->size(), sizeof(buf_));
-				size_t n = ::fread(buf_, 1, toRead, fd_);
+				size_t n = ::fread(buf_, 1, toRead, fp_);
 				if (n > 0) {
 					content->append(buf_, n);
 				} else {
@@ -86,8 +87,8 @@ public:
 
 	int readToBuffer(int* size) {
 		int err = err_;
-		if (fd_ >= 0) {
-			size_t n = ::fread(buf_, 1, sizeof(buf_) - 1, fd_);
+		if (fp_) {
+			size_t n = ::fread(buf_, 1, sizeof(buf_) - 1, fp_);
 			if (n >= 0) {
 				if (size) {
 					*size = static_cast<int>(n);
@@ -105,7 +106,7 @@ public:
 	static constexpr int BUFFER_SIZE = 64 * 1024;
 
 private:
-	int fd_;
+	FILE* fp_;
 	int err_;
 	char buf_[BUFFER_SIZE];
 };
@@ -120,20 +121,74 @@ int readFile(StringArg filename, int maxSize, String* content, int64_t* fileSize
 
 
 //! not thread safe
-class AppendToFile : noncopyable
+class AppendFile : noncopyable
 {
 public:
-	explicit AppendToFile(StringArg filename)
+	explicit AppendFile(StringArg filename)
+#ifdef JLIB_WINDOWS
+		: fp_(::fopen(filename.c_str(), "ab"))
+#else
+		: fp_(::fopen(filename.c_str(), "ae")) // 'e' for O_CLOEXEC
+#endif
+		, writtenBytes_(0)
 	{
+		if (!fp_) {
+			// append and flush become no-ops, the owner may retry with a new file
+			fprintf(stderr, "AppendFile::AppendFile() open %s failed %s\n", filename.c_str(), strerror(errno));
+			return;
+		}
+		// user-space buffer, fwrite only hits the kernel every BUFFER_SIZE bytes
+#ifdef JLIB_WINDOWS
+		::setvbuf(fp_, buf_, _IOFBF, sizeof(buf_));
+#else
+		::setbuffer(fp_, buf_, sizeof(buf_));
+#endif
+	}
 
+	~AppendFile() {
+		if (fp_) {
+			::fclose(fp_);
+		}
 	}
 
-	static constexpr int BUFFER_SIZE = 64 * 1024;
+	//! false if the file could not be opened
+	bool valid() const { return fp_ != nullptr; }
 
+	void append(const char* logLine, size_t len) {
+		if (!fp_) {
+			return;
+		}
+		size_t n = write(logLine, len);
+		size_t remain = len - n;
+		while (remain > 0) {
+			size_t x = write(logLine + n, remain);
+			if (x == 0) {
+				int err = ferror(fp_);
+				if (err) {
+					fprintf(stderr, "AppendFile::append() failed %s\n", strerror(err));
+				}
+				break;
+			}
+			n += x;
+			remain = len - n;
+		}
+		writtenBytes_ += len;
+	}
+
+	void flush() { if (fp_) { ::fflush(fp_); } }
+
+	off_t writtenBytes() const { return writtenBytes_; }
+
+	static constexpr int BUFFER_SIZE = 64 * 1024;
 
 private:
+	//! caller must guarantee exclusive access to fp_
 	size_t write(const char* logLine, size_t len) {
-
+#ifdef JLIB_WINDOWS
+		return ::_fwrite_nolock(logLine, 1, len, fp_);
+#else
+		return ::fwrite_unlocked(logLine, 1, len, fp_);
+#endif
 	}
 
 	FILE* fp_;
@@ -0,0 +1,256 @@
+﻿#pragma once
+
+#include "config.h"
+#include <assert.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace jlib
+{
+
+template <typename T>
+class Future;
+
+namespace detail
+{
+
+/**
+* @brief Shared state of a Future, one allocation holding refcount, result and sync.
+* Setter never locks unless someone is already blocked in wait(),
+* getter doesn't lock if the result is ready.
+*/
+class FutureStateBase
+{
+public:
+	FutureStateBase() : refs_(1), status_(EMPTY) {}
+	virtual ~FutureStateBase() {}
+
+	void addRef() { refs_.fetch_add(1, std::memory_order_relaxed); }
+	void release() {
+		if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			delete this;
+		}
+	}
+
+	bool isReady() const { return status_.load(std::memory_order_acquire) == READY; }
+
+	void wait() {
+		if (isReady()) { return; }
+		std::unique_lock<std::mutex> lock(mutex_);
+		int expected = EMPTY;
+		status_.compare_exchange_strong(expected, WAITING, std::memory_order_acq_rel);
+		cond_.wait(lock, [this]() { return isReady(); });
+	}
+
+	template <typename Rep, typename Period>
+	bool waitFor(const std::chrono::duration<Rep, Period>& timeout) {
+		if (isReady()) { return true; }
+		std::unique_lock<std::mutex> lock(mutex_);
+		int expected = EMPTY;
+		status_.compare_exchange_strong(expected, WAITING, std::memory_order_acq_rel);
+		return cond_.wait_for(lock, timeout, [this]() { return isReady(); });
+	}
+
+	void setException(std::exception_ptr ex) {
+		exception_ = ex;
+		setReady();
+	}
+
+protected:
+	void setReady() {
+		if (status_.exchange(READY, std::memory_order_acq_rel) == WAITING) {
+			// waiter holds the lock between checking and sleeping, so lock before notify
+			std::lock_guard<std::mutex> lock(mutex_);
+			cond_.notify_all();
+		}
+	}
+
+	void rethrowIfException() {
+		if (exception_) { std::rethrow_exception(exception_); }
+	}
+
+private:
+	enum Status { EMPTY, WAITING, READY };
+
+	std::atomic<int> refs_;
+	std::atomic<int> status_;
+	std::mutex mutex_;
+	std::condition_variable cond_;
+	std::exception_ptr exception_;
+};
+
+template <typename T>
+class FutureState : public FutureStateBase
+{
+public:
+	FutureState() : hasValue_(false) {}
+	~FutureState() {
+		if (hasValue_) { value().~T(); }
+	}
+
+	template <typename F>
+	void run(F& f) {
+		try {
+			::new (&storage_) T(f());
+			hasValue_ = true;
+			setReady();
+		} catch (...) {
+			setException(std::current_exception());
+		}
+	}
+
+	T get() {
+		wait();
+		rethrowIfException();
+		return std::move(value());
+	}
+
+private:
+	T& value() { return *reinterpret_cast<T*>(&storage_); }
+
+	typename std::aligned_storage<sizeof(T), alignof(T)>::type storage_;
+	bool hasValue_;
+};
+
+template <typename T>
+class FutureState<T&> : public FutureStateBase
+{
+public:
+	FutureState() : value_(nullptr) {}
+
+	template <typename F>
+	void run(F& f) {
+		try {
+			value_ = &f();
+			setReady();
+		} catch (...) {
+			setException(std::current_exception());
+		}
+	}
+
+	T& get() {
+		wait();
+		rethrowIfException();
+		return *value_;
+	}
+
+private:
+	T* value_;
+};
+
+template <>
+class FutureState<void> : public FutureStateBase
+{
+public:
+	template <typename F>
+	void run(F& f) {
+		try {
+			f();
+			setReady();
+		} catch (...) {
+			setException(std::current_exception());
+		}
+	}
+
+	void get() {
+		wait();
+		rethrowIfException();
+	}
+};
+
+//! intrusive pointer to FutureState
+template <typename T>
+class FutureStatePtr
+{
+public:
+	FutureStatePtr() : p_(nullptr) {}
+	explicit FutureStatePtr(FutureState<T>* p) : p_(p) {} // adopts the initial ref
+	FutureStatePtr(const FutureStatePtr& rhs) : p_(rhs.p_) { if (p_) { p_->addRef(); } }
+	FutureStatePtr(FutureStatePtr&& rhs) noexcept : p_(rhs.p_) { rhs.p_ = nullptr; }
+	FutureStatePtr& operator=(FutureStatePtr rhs) noexcept { std::swap(p_, rhs.p_); return *this; }
+	~FutureStatePtr() { if (p_) { p_->release(); } }
+
+	FutureState<T>* operator->() const { return p_; }
+	explicit operator bool() const { return p_ != nullptr; }
+
+private:
+	FutureState<T>* p_;
+};
+
+/**
+* @brief Held by the task producing a Future.
+* A task destroyed without running, e.g. discarded by ThreadPool::stop(),
+* breaks the promise instead of leaving get() blocked forever.
+*/
+template <typename T>
+class FutureSetter
+{
+public:
+	explicit FutureSetter(FutureStatePtr<T> state) : state_(std::move(state)) {}
+	FutureSetter(FutureSetter&&) noexcept = default;
+	FutureSetter& operator=(FutureSetter&&) = delete;
+	~FutureSetter() {
+		if (state_) {
+			state_->setException(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+		}
+	}
+
+	template <typename F>
+	void run(F& f) {
+		FutureStatePtr<T> state(std::move(state_));
+		state->run(f);
+	}
+
+private:
+	FutureStatePtr<T> state_;
+};
+
+} // namespace detail
+
+
+/**
+* @brief Result of ThreadPool::submit(), a lightweight std::future.
+* Exceptions thrown by the task are rethrown by get(),
+* std::future_error with broken_promise if the task was discarded without running.
+*/
+template <typename T>
+class Future
+{
+public:
+	Future() {}
+	explicit Future(detail::FutureStatePtr<T> state) : state_(std::move(state)) {}
+
+	Future(Future&&) = default;
+	Future& operator=(Future&&) = default;
+	Future(const Future&) = delete;
+	Future& operator=(const Future&) = delete;
+
+	bool valid() const { return static_cast<bool>(state_); }
+	bool isReady() const { assert(valid()); return state_->isReady(); }
+	void wait() const { assert(valid()); state_->wait(); }
+
+	template <typename Rep, typename Period>
+	bool waitFor(const std::chrono::duration<Rep, Period>& timeout) const {
+		assert(valid());
+		return state_->waitFor(timeout);
+	}
+
+	//! blocks until ready, can only be called once
+	T get() {
+		assert(valid());
+		detail::FutureStatePtr<T> state(std::move(state_));
+		return state->get();
+	}
+
+private:
+	detail::FutureStatePtr<T> state_;
+};
+
+}
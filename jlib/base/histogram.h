@@ -0,0 +1,163 @@
+﻿#pragma once
+
+#include "config.h"
+#include "noncopyable.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace jlib
+{
+
+namespace detail
+{
+
+//! index of highest set bit, v must not be 0
+inline int highestBit(uint64_t v)
+{
+#ifdef _MSC_VER
+	unsigned long index = 0;
+	_BitScanReverse64(&index, v);
+	return static_cast<int>(index);
+#else
+	return 63 - __builtin_clzll(v);
+#endif
+}
+
+}
+
+/**
+* @brief Log-linear bucketing: values below SUB_BUCKETS get one bucket each,
+* every power of 2 above is split into SUB_BUCKETS linear buckets, so relative error < 1/SUB_BUCKETS.
+* Values >= 2^MAX_BITS are clamped into the last bucket.
+*/
+struct LogLinearBuckets
+{
+	static constexpr int SUB_BITS = 4;
+	static constexpr uint64_t SUB_BUCKETS = 1ULL << SUB_BITS;
+	static constexpr int MAX_BITS = 48; // 78 hours in ns
+	static constexpr size_t COUNT = static_cast<size_t>(MAX_BITS - SUB_BITS + 1) * SUB_BUCKETS;
+
+	static size_t indexOf(uint64_t v) {
+		if (v < SUB_BUCKETS) {
+			return static_cast<size_t>(v);
+		}
+		int shift = detail::highestBit(v) - SUB_BITS;
+		if (shift > MAX_BITS - SUB_BITS - 1) {
+			return COUNT - 1;
+		}
+		return static_cast<size_t>((shift + 1) * SUB_BUCKETS + ((v >> shift) - SUB_BUCKETS));
+	}
+
+	//! smallest value falling into bucket
+	static uint64_t lowerBound(size_t index) {
+		if (index < SUB_BUCKETS) {
+			return index;
+		}
+		int shift = static_cast<int>(index / SUB_BUCKETS) - 1;
+		return (SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+	}
+
+	//! largest value falling into bucket
+	static uint64_t upperBound(size_t index) {
+		return index + 1 < COUNT ? lowerBound(index + 1) - 1 : UINT64_MAX;
+	}
+};
+
+//! point in time copy of a LogLinearHistogram, can be merged with others
+struct HistogramSnapshot
+{
+	uint64_t count = 0;
+	uint64_t sum = 0;
+	uint64_t max = 0;
+	std::vector<uint64_t> buckets = std::vector<uint64_t>(LogLinearBuckets::COUNT, 0);
+
+	double mean() const { return count ? static_cast<double>(sum) / count : 0.0; }
+
+	//! upper bound of the bucket holding the p-th percentile (0 < p <= 100), never above max
+	uint64_t percentile(double p) const {
+		if (count == 0) {
+			return 0;
+		}
+		uint64_t rank = static_cast<uint64_t>(p / 100.0 * count + 0.5);
+		if (rank < 1) { rank = 1; }
+		uint64_t seen = 0;
+		for (size_t i = 0; i < buckets.size(); i++) {
+			seen += buckets[i];
+			if (seen >= rank) {
+				uint64_t upper = LogLinearBuckets::upperBound(i);
+				return upper < max ? upper : max;
+			}
+		}
+		return max;
+	}
+
+	HistogramSnapshot& merge(const HistogramSnapshot& rhs) {
+		count += rhs.count;
+		sum += rhs.sum;
+		if (rhs.max > max) { max = rhs.max; }
+		for (size_t i = 0; i < buckets.size(); i++) {
+			buckets[i] += rhs.buckets[i];
+		}
+		return *this;
+	}
+};
+
+/**
+* @brief Histogram of non-negative integers such as latencies in ns.
+* record() is a handful of relaxed atomic ops, snapshot() may run concurrently with it,
+* count/sum/buckets are then only approximately consistent with each other.
+* Keep one per writer thread, recording with recordExclusive(), and merge snapshots to avoid contended cache lines.
+*/
+class LogLinearHistogram : noncopyable
+{
+public:
+	LogLinearHistogram() {
+		for (auto& bucket : buckets_) {
+			bucket.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	void record(uint64_t v) {
+		buckets_[LogLinearBuckets::indexOf(v)].fetch_add(1, std::memory_order_relaxed);
+		count_.fetch_add(1, std::memory_order_relaxed);
+		sum_.fetch_add(v, std::memory_order_relaxed);
+		uint64_t max = max_.load(std::memory_order_relaxed);
+		while (v > max && !max_.compare_exchange_weak(max, v, std::memory_order_relaxed)) {}
+	}
+
+	//! record() without read-modify-write ops, only valid when a single thread ever records
+	void recordExclusive(uint64_t v) {
+		auto& bucket = buckets_[LogLinearBuckets::indexOf(v)];
+		bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		count_.store(count_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		sum_.store(sum_.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+		if (v > max_.load(std::memory_order_relaxed)) {
+			max_.store(v, std::memory_order_relaxed);
+		}
+	}
+
+	HistogramSnapshot snapshot() const {
+		HistogramSnapshot s;
+		s.count = count_.load(std::memory_order_relaxed);
+		s.sum = sum_.load(std::memory_order_relaxed);
+		s.max = max_.load(std::memory_order_relaxed);
+		for (size_t i = 0; i < LogLinearBuckets::COUNT; i++) {
+			s.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+		}
+		return s;
+	}
+
+private:
+	std::atomic<uint64_t> count_{ 0 };
+	std::atomic<uint64_t> sum_{ 0 };
+	std::atomic<uint64_t> max_{ 0 };
+	std::atomic<uint64_t> buckets_[LogLinearBuckets::COUNT];
+};
+
+}
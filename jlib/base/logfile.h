@@ -2,20 +2,19 @@
 
 #include "config.h"
 #include "noncopyable.h"
+#include "fileutil.h"
+#include "process.h"
 #include <mutex>
 #include <memory>
 #include <string>
 #include <assert.h>
 #include <sys/types.h>  // for off_t
+#include <time.h>
+#include <stdio.h>
 
 namespace jlib
 {
 
-namespace FileUtil
-{
-class AppendFile;
-}
-
 class LogFile : noncopyable
 {
 public:
@@ -56,17 +55,62 @@ public:
 	}
 
 	bool rollFile() {
-
+		time_t now = ::time(nullptr);
+		time_t start = now / ROLL_PER_SECONDS * ROLL_PER_SECONDS;
+		if (now > lastRoll_) {
+			lastRoll_ = now;
+			lastFlush_ = now;
+			startOfPeriod_ = start;
+			file_.reset(new FileUtil::AppendFile(getLogFileName(basename_, now)));
+			return true;
+		}
+		return false;
 	}
 
 protected:
 	void appendUnlocked(const char* logLine, int len) {
+		if (!file_->valid()) {
+			// open failed, try a new file at most once a second
+			rollFile();
+		}
 		file_->append(logLine, len);
-		
+		if (file_->writtenBytes() > rollSize_) {
+			rollFile();
+		} else if (++count_ >= checkEveryN_) {
+			// only look at the clock every checkEveryN_ lines
+			count_ = 0;
+			time_t now = ::time(nullptr);
+			time_t thisPeriod = now / ROLL_PER_SECONDS * ROLL_PER_SECONDS;
+			if (thisPeriod != startOfPeriod_) {
+				rollFile();
+			} else if (now - lastFlush_ > flushInterval_) {
+				lastFlush_ = now;
+				file_->flush();
+			}
+		}
 	}
 
+	//! basename.yyyymmdd-HHMMSS.pid.log
 	static std::string getLogFileName(const std::string& basename, time_t now) {
-
+		std::string filename;
+		filename.reserve(basename.size() + 64);
+		filename = basename;
+
+		char timebuf[32];
+		struct tm tm;
+#ifdef JLIB_WINDOWS
+		gmtime_s(&tm, &now);
+#else
+		gmtime_r(&now, &tm);
+#endif
+		strftime(timebuf, sizeof(timebuf), ".%Y%m%d-%H%M%S.", &tm);
+		filename += timebuf;
+
+		char pidbuf[32];
+		snprintf(pidbuf, sizeof(pidbuf), "%llu", static_cast<unsigned long long>(getPid()));
+		filename += pidbuf;
+		filename += ".log";
+		return filename;
 	}
 
 private:
@@ -5,6 +5,7 @@
 #include "timestamp.h"
 #include "timezone.h"
 #include "currentthread.h"
+#include "logsampling.h"
 #include <stdlib.h> // getenv
 #include <errno.h>
 #include <string.h> // strerror_r
@@ -63,6 +64,10 @@ public:
 	Logger(SourceFile file, int line, LogLevel level) : impl_(level, 0, file, line) {}
 	Logger(SourceFile file, int line, LogLevel level, const char* func) : impl_(level, 0, file, line) { impl_.stream_ << func << ' '; }
 	Logger(SourceFile file, int line, bool toAbort) : impl_(toAbort ? LogLevel::LOGLEVEL_FATAL : LOGLEVEL_ERROR, errno, file, line) {}
+	//! replay a statement recorded on thread tid at time, e.g. by BinaryLogging, func may be null
+	Logger(SourceFile file, int line, LogLevel level, const char* func, Timestamp time, uint64_t tid) : impl_(level, file, line, time, tid) {
+		if (func) { impl_.stream_ << func << ' '; }
+	}
 
 	~Logger() {
 		impl_.finish();
@@ -82,9 +87,10 @@ public:
 	typedef void (*OutputFunc)(const char* msg, int len);
 	typedef void (*FlushFunc)();
 
-	static void setOutput(OutputFunc);
-	static void setFlush(FlushFunc);
-	static void setTimeZone(const TimeZone& tz);
+	static void setOutput(OutputFunc out) { outputFunc_ = out; }
+	static void setFlush(FlushFunc flush) { flushFunc_ = flush; }
+	static void setTimeZone(const TimeZone& tz) { timeZone_ = &tz; }
+	static void flush() { flushFunc_(); }
 
 private:
 
@@ -94,6 +100,7 @@ private:
 		typedef Logger::LogLevel LogLevel;
 
 		Impl(LogLevel level, int old_errno, const SourceFile& file, int line);
+		Impl(LogLevel level, const SourceFile& file, int line, Timestamp time, uint64_t tid);
 		void formatTime();
 		void finish();
 
@@ -115,22 +122,73 @@ private:
 
 /******** log micros *********/
 
-#define LOG_TRACE if (jlib::Logger::logLevel() <= jlib::Logger::LogLevel::LOGLEVEL_TRACE) \
+/*
+* JLIB_MIN_LOG_LEVEL: compile time minimum log level, defaults to 0 (TRACE).
+* 0 TRACE, 1 DEBUG, 2 INFO, 3 WARN, 4 ERROR, 5 FATAL.
+* Statements below it compile to nothing, their arguments are never evaluated,
+* e.g. build release with -DJLIB_MIN_LOG_LEVEL=2 to drop LOG_TRACE and LOG_DEBUG.
+* LOG_FATAL and LOG_SYSFATAL are never compiled out.
+*/
+#ifndef JLIB_MIN_LOG_LEVEL
+#define JLIB_MIN_LOG_LEVEL 0
+#endif
+
+static_assert(JLIB_MIN_LOG_LEVEL >= jlib::Logger::LogLevel::LOGLEVEL_TRACE
+			  && JLIB_MIN_LOG_LEVEL <= jlib::Logger::LogLevel::LOGLEVEL_FATAL, "invalid JLIB_MIN_LOG_LEVEL");
+
+//! type checked but never executed
+#define JLIB_LOG_DISCARD(level) while (false) \
+	jlib::Logger(__FILE__, __LINE__, jlib::Logger::LogLevel::level).stream()
+
+#if JLIB_MIN_LOG_LEVEL <= 0
+#define LOG_TRACE if (JLIB_UNLIKELY(jlib::Logger::logLevel() <= jlib::Logger::LogLevel::LOGLEVEL_TRACE)) JLIB_ATTR_UNLIKELY \
 	jlib::Logger(__FILE__, __LINE__, jlib::Logger::LogLevel::LOGLEVEL_TRACE, __func__).stream()
+#else
+#define LOG_TRACE JLIB_LOG_DISCARD(LOGLEVEL_TRACE)
+#endif
 
-#define LOG_DEBUG if (jlib::Logger::logLevel() <= jlib::Logger::LogLevel::LOGLEVEL_DEBUG) \
+#if JLIB_MIN_LOG_LEVEL <= 1
+#define LOG_DEBUG if (JLIB_UNLIKELY(jlib::Logger::logLevel() <= jlib::Logger::LogLevel::LOGLEVEL_DEBUG)) JLIB_ATTR_UNLIKELY \
 	jlib::Logger(__FILE__, __LINE__, jlib::Logger::LogLevel::LOGLEVEL_DEBUG, __func__).stream()
+#else
+#define LOG_DEBUG JLIB_LOG_DISCARD(LOGLEVEL_DEBUG)
+#endif
 
-#define LOG_INFO if (jlib::Logger::logLevel() <= jlib::Logger::LogLevel::LOGLEVEL_INFO) \
+#if JLIB_MIN_LOG_LEVEL <= 2
+#define LOG_INFO if (JLIB_LIKELY(jlib::Logger::logLevel() <= jlib::Logger::LogLevel::LOGLEVEL_INFO)) \
 	jlib::Logger(__FILE__, __LINE__, jlib::Logger::LogLevel::LOGLEVEL_INFO).stream()
+#else
+#define LOG_INFO JLIB_LOG_DISCARD(LOGLEVEL_INFO)
+#endif
 
-
+#if JLIB_MIN_LOG_LEVEL <= 3
 #define LOG_WARN jlib::Logger(__FILE__, __LINE__, jlib::Logger::LogLevel::LOGLEVEL_WARN).stream()
+#else
+#define LOG_WARN JLIB_LOG_DISCARD(LOGLEVEL_WARN)
+#endif
+
+#if JLIB_MIN_LOG_LEVEL <= 4
 #define LOG_ERROR jlib::Logger(__FILE__, __LINE__, jlib::Logger::LogLevel::LOGLEVEL_ERROR).stream()
-#define LOG_FATAL jlib::Logger(__FILE__, __LINE__, jlib::Logger::LogLevel::LOGLEVEL_FATAL).stream()
 #define LOG_SYSERR jlib::Logger(__FILE__, __LINE__, false).stream()
+#else
+#define LOG_ERROR JLIB_LOG_DISCARD(LOGLEVEL_ERROR)
+#define LOG_SYSERR JLIB_LOG_DISCARD(LOGLEVEL_ERROR)
+#endif
+
+#define LOG_FATAL jlib::Logger(__FILE__, __LINE__, jlib::Logger::LogLevel::LOGLEVEL_FATAL).stream()
 #define LOG_SYSFATAL jlib::Logger(__FILE__, __LINE__, true).stream()
 
+/*
+* Rate limited statements, counted per call site, e.g.
+*   LOG_EVERY_N(WARN, 100) << "logged on occurrence 1, 101, 201 ...";
+*   LOG_FIRST_N(ERROR, 10) << "logged 10 times at most";
+*   LOG_EVERY_T(ERROR, 1000) << "logged once a second at most";
+* Occurrences are counted whether or not the level is enabled.
+*/
+#define LOG_EVERY_N(level, n) JLIB_LOG_IF_EVERY_N(n) LOG_##level
+#define LOG_FIRST_N(level, n) JLIB_LOG_IF_FIRST_N(n) LOG_##level
+#define LOG_EVERY_T(level, ms) JLIB_LOG_IF_EVERY_T(ms) LOG_##level
+
 
 namespace detail
 {
@@ -173,7 +231,22 @@ struct T
 thread_local char t_errnobuf[512] = { 0 };
 thread_local char t_time[64] = { 0 };
 thread_local time_t t_lastSecond = 0;
-static constexpr unsigned int T_TIME_STR_LEN = 17;
+static constexpr unsigned int T_TIME_STR_LEN = 19; // %F %T without sub-seconds
+
+// cached sys_info of the last looked up zone, only refreshed when leaving [begin, end)
+thread_local const TimeZone* t_lastZone = nullptr;
+thread_local time_t t_zoneBegin = 0;
+thread_local time_t t_zoneEnd = 0;
+thread_local time_t t_zoneOffset = 0;
+thread_local char t_zoneName[32] = { 0 }; // "(%Z) "
+thread_local unsigned int t_zoneNameLength = 0;
+
+//! write 2 digits of v, v must be in [0, 99]
+inline char* format2Digits(char* p, int v) {
+	p[0] = static_cast<char>('0' + v / 10);
+	p[1] = static_cast<char>('0' + v % 10);
+	return p + 2;
+}
 
 } // detail
 
@@ -220,34 +293,66 @@ Logger::Impl::Impl(LogLevel level, int old_errno, const SourceFile& file, int li
 	}
 }
 
+Logger::Impl::Impl(LogLevel level, const SourceFile& file, int line, Timestamp time, uint64_t tid)
+	: time_(time)
+	, stream_()
+	, level_(level)
+	, line_(line)
+	, basename_(file)
+{
+	formatTime();
+	char tidString[32];
+	size_t len = detail::convert(tidString, tid);
+	tidString[len++] = ' '; tidString[len] = '\0';
+	stream_ << detail::T(tidString, static_cast<unsigned int>(len));
+	stream_ << detail::T(detail::LogLevelName[level], 6);
+}
+
 void Logger::Impl::formatTime()
 {
-	//int64_t microSecsSinceEpoch = time_.microSecondsSinceEpoch();
-	//time_t seconds = static_cast<time_t>(microSecsSinceEpoch / MICRO_SECONDS_PER_SECOND);
-	//int microsecs = static_cast<int>(microSecsSinceEpoch % MICRO_SECONDS_PER_SECOND);
-	//if (seconds != detail::t_lastSecond) {
-	//	detail::t_lastSecond = seconds;
-	//	struct tm tm_time;
-	//	if (timeZone_.valid()) {
-	//		// TODO
-	//	} else {
-	//		gmtime_r(&seconds, &tm_time);
-	//	}
-
-	//	int len = snprintf(detail::t_time, sizeof(detail::t_time), "%4d%02d%02d %02d:%02d:%02d",
-	//					   tm_time.tm_year + 1900, tm_time.tm_mon + 1, tm_time.tm_mday,
-	//					   tm_time.tm_hour, tm_time.tm_min, tm_time.tm_sec);
-	//	assert(len == detail::T_TIME_STR_LEN); (void)len;
-	//}
-
-	//if (timeZone_.valid()) {
-	//	// TODO
-	//} else {
-	//	Format us(".%06dZ ", microsecs); assert(us.length() == 9);
-	//	stream_ << detail::T(detail::t_time, detail::T_TIME_STR_LEN) << detail::T(us.data(), 9);
-	//}
-
-	stream_ << format("%F %T(%Z) ", time_);
+	int64_t microSecsSinceEpoch = time_.time_since_epoch().count();
+	time_t seconds = static_cast<time_t>(microSecsSinceEpoch / 1000000);
+	int microsecs = static_cast<int>(microSecsSinceEpoch % 1000000);
+
+	if (timeZone_ != detail::t_lastZone || seconds < detail::t_zoneBegin || seconds >= detail::t_zoneEnd) {
+		auto info = timeZone_->get_info(sys_seconds(std::chrono::seconds(seconds)));
+		detail::t_lastZone = timeZone_;
+		detail::t_zoneBegin = static_cast<time_t>(info.begin.time_since_epoch().count());
+		detail::t_zoneEnd = static_cast<time_t>(info.end.time_since_epoch().count());
+		detail::t_zoneOffset = static_cast<time_t>(info.offset.count());
+		detail::t_zoneNameLength = static_cast<unsigned int>(snprintf(detail::t_zoneName, sizeof(detail::t_zoneName), "(%s) ", info.abbrev.c_str()));
+		detail::t_lastSecond = -1; // offset may have changed
+	}
+
+	if (seconds != detail::t_lastSecond) {
+		detail::t_lastSecond = seconds;
+		auto local = sys_seconds(std::chrono::seconds(seconds + detail::t_zoneOffset));
+		auto dp = floor<days>(local);
+		year_month_day ymd(dp);
+		hh_mm_ss<std::chrono::seconds> hms(local - dp);
+
+		int year = static_cast<int>(ymd.year());
+		char* p = detail::t_time;
+		p = detail::format2Digits(p, year / 100);
+		p = detail::format2Digits(p, year % 100); *p++ = '-';
+		p = detail::format2Digits(p, static_cast<int>(static_cast<unsigned>(ymd.month()))); *p++ = '-';
+		p = detail::format2Digits(p, static_cast<int>(static_cast<unsigned>(ymd.day()))); *p++ = ' ';
+		p = detail::format2Digits(p, static_cast<int>(hms.hours().count())); *p++ = ':';
+		p = detail::format2Digits(p, static_cast<int>(hms.minutes().count())); *p++ = ':';
+		p = detail::format2Digits(p, static_cast<int>(hms.seconds().count())); *p = '\0';
+		assert(p - detail::t_time == detail::T_TIME_STR_LEN);
+	}
+
+	char us[8];
+	us[0] = '.';
+	for (int i = 6; i > 0; i--) {
+		us[i] = static_cast<char>('0' + microsecs % 10);
+		microsecs /= 10;
+	}
+	us[7] = '\0';
+
+	stream_ << detail::T(detail::t_time, detail::T_TIME_STR_LEN) << detail::T(us, 7)
+		<< detail::T(detail::t_zoneName, detail::t_zoneNameLength);
 }
 
 void Logger::Impl::finish()
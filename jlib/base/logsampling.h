@@ -0,0 +1,59 @@
+﻿#pragma once
+
+#include "config.h"
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <stdint.h>
+
+/*
+* Per call site rate limiting for log statements, shared by base/logging.h and log2.h.
+* Each macro expansion owns its counters, a suppressed statement costs one relaxed atomic op.
+*/
+
+namespace jlib
+{
+
+namespace detail
+{
+
+//! true for occurrence 1, n+1, 2n+1 ...
+inline bool logEveryN(std::atomic<uint64_t>& counter, uint64_t n)
+{
+	return counter.fetch_add(1, std::memory_order_relaxed) % n == 0;
+}
+
+//! true for the first n occurrences
+inline bool logFirstN(std::atomic<uint64_t>& counter, uint64_t n)
+{
+	// stop writing the counter once it's done, keeps the cache line shared
+	return counter.load(std::memory_order_relaxed) < n
+		&& counter.fetch_add(1, std::memory_order_relaxed) < n;
+}
+
+static constexpr int64_t LOG_EVERY_T_NEVER = (std::numeric_limits<int64_t>::min)();
+
+//! true at most once every ms milliseconds, the first occurrence always passes
+inline bool logEveryT(std::atomic<int64_t>& last, int64_t ms)
+{
+	int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+	int64_t prev = last.load(std::memory_order_relaxed);
+	if (prev != LOG_EVERY_T_NEVER && now - prev < ms) {
+		return false;
+	}
+	// only one thread wins when several pass the check at once
+	return last.compare_exchange_strong(prev, now, std::memory_order_relaxed);
+}
+
+} // namespace detail
+
+} // namespace jlib
+
+//! a static of type T initialized with init, unique to each expansion
+#define JLIB_LOG_SITE_STATIC(T, init) \
+	([]() -> T& { static T site_static_{ init }; return site_static_; }())
+
+#define JLIB_LOG_IF_EVERY_N(n) if (jlib::detail::logEveryN(JLIB_LOG_SITE_STATIC(std::atomic<uint64_t>, 0), (n)))
+#define JLIB_LOG_IF_FIRST_N(n) if (jlib::detail::logFirstN(JLIB_LOG_SITE_STATIC(std::atomic<uint64_t>, 0), (n)))
+#define JLIB_LOG_IF_EVERY_T(ms) if (jlib::detail::logEveryT(JLIB_LOG_SITE_STATIC(std::atomic<int64_t>, jlib::detail::LOG_EVERY_T_NEVER), (ms)))
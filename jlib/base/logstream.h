@@ -4,18 +4,31 @@
 #include "noncopyable.h"
 #include "stringpiece.h"
 #include "cast.h"
+#include "convert.h"
 #include <assert.h>
 #include <string.h>
 #include <algorithm>
+#include <atomic>
+#include <memory>
 #include <limits>
 #include <type_traits>
 #include <stdint.h>
 #include <stdio.h>
 #include <inttypes.h>
+#if __has_include(<charconv>)
+#include <charconv>
+#endif
 
 namespace jlib
 {
 
+enum class FloatFormat {
+	general,	// like printf "%.{precision}g"
+	fixed,		// like printf "%.{precision}f"
+	scientific,	// like printf "%.{precision}e"
+	shortest,	// shortest representation that round-trips, precision ignored
+};
+
 namespace detail
 {
 
@@ -71,46 +84,183 @@ template class FixedBuffer<SMALL_BUFFER>;
 template class FixedBuffer<LARGE_BUFFER>;
 
 
-// Efficient Integer to String Conversions, by Matthew Wilson.
-template <typename T>
-inline size_t convert(char buf[], T value)
+//! longest log line LogBuffer grows to, longer lines are truncated
+static constexpr int MAX_LOG_LINE = 1024 * 1024;
+
+/**
+* @brief SMALL_BUFFER bytes per thread, shared by all LogBuffers of that thread.
+* A LogBuffer may end up destroyed on another thread, even after its owner thread exited,
+* so whichever of the owner thread and the borrower lets go last frees the storage.
+*/
+struct ThreadLogStorage
 {
-    static const char digits[] = "9876543210123456789";
-    static const char* zero = digits + 9;
-    static_assert(sizeof(digits) == 20, "wrong number of digits");
+	enum : int { IN_USE = 1, ORPHANED = 2 };
+
+	char data[SMALL_BUFFER];
+	std::atomic<int> state{ 0 };
+
+	//! owner thread only
+	bool tryBorrow() {
+		if (state.load(std::memory_order_acquire) != 0) {
+			return false;
+		}
+		state.store(IN_USE, std::memory_order_relaxed); // no one else sets IN_USE
+		return true;
+	}
 
-    T i = value;
-    char *p = buf;
+	//! owner is true when called on the owner thread, which can't have orphaned it
+	void giveBack(bool owner) {
+		if (owner) {
+			state.store(0, std::memory_order_release);
+		} else if (state.fetch_and(~IN_USE, std::memory_order_acq_rel) & ORPHANED) {
+			delete this;
+		}
+	}
 
-    do {
-        int lsd = static_cast<int>(i % 10);
-        i /= 10; *p++ = zero[lsd];
-    } while (i != 0);
+	//! owner thread exiting
+	void orphan() {
+		if (!(state.fetch_or(ORPHANED, std::memory_order_acq_rel) & IN_USE)) {
+			delete this;
+		}
+	}
+};
 
-    if (value < 0) { *p++ = '-'; }
-    *p = '\0';
-    std::reverse(buf, p);
+struct ThreadLogStorageHolder
+{
+	ThreadLogStorage* storage = new ThreadLogStorage();
+	~ThreadLogStorageHolder() {
+		storage->orphan();
+		storage = nullptr;
+	}
+};
 
-    return p - buf;
+//! null while the calling thread's thread locals are being destroyed
+inline ThreadLogStorage* threadLogStorage() {
+	thread_local ThreadLogStorageHolder holder;
+	return holder.storage;
 }
 
-static size_t convertHex(char buf[], uintptr_t value)
+/**
+* @brief Log line buffer with the same interface as FixedBuffer<SMALL_BUFFER>.
+* Borrows the thread local storage instead of putting 4KB on the stack for every log statement,
+* falls back to the heap when it is already borrowed (nested LogStreams on one thread),
+* may be destroyed on a thread other than the one that constructed it,
+* and grows on the heap up to MAX_LOG_LINE instead of dropping long messages.
+*/
+class LogBuffer : noncopyable
 {
-    static const char digitsHex[] = "0123456789ABCDEF";
-    static_assert(sizeof(digitsHex) == 17, "wrong number of digitsHex");
-    
-    uintptr_t i = value;
-    char *p = buf;
+public:
+	LogBuffer() : storage_(threadLogStorage()) {
+		if (JLIB_LIKELY(storage_ && storage_->tryBorrow())) {
+			data_ = storage_->data;
+		} else {
+			storage_ = nullptr;
+			heap_.reset(new char[SMALL_BUFFER]);
+			data_ = heap_.get();
+		}
+		cur_ = data_;
+		end_ = data_ + SMALL_BUFFER;
+	}
+
+	~LogBuffer() {
+		releaseStorage();
+	}
+
+	void append(const char* buf, size_t len) {
+		if (JLIB_UNLIKELY(implicit_cast<size_t>(avail()) <= len) && !grow(len)) {
+			len = avail() - 1; // truncate at MAX_LOG_LINE
+		}
+		memcpy(cur_, buf, len); cur_ += len;
+	}
 
-    do {
-        int lsd = static_cast<int>(i % 16);
-        i /= 16; *p++ = digitsHex[lsd];
-    } while (i != 0);
+	//! make sure len bytes can be written to current(), grow if needed
+	bool ensure(size_t len) {
+		return implicit_cast<size_t>(avail()) > len || grow(len);
+	}
+
+	const char *data() const { return data_; }
+	int length() const { return static_cast<int>(cur_ - data_); }
+	int capacity() const { return static_cast<int>(end_ - data_); }
 
-    *p = '\0';
-    std::reverse(buf, p);
+	// write to data_ directly
+	char *current() { return cur_; }
+	int avail() const { return static_cast<int>(end_ - cur_); }
+	void add(size_t len) { cur_ += len; }
 
-    return p - buf;
+	void reset() { cur_ = data_; }
+	void bzero() { memset(data_, 0, capacity()); }
+
+	// for used by GDB
+	const char *debugString() { *cur_ = '\0'; return data_; }
+
+	// for used by unit test
+	std::string toString() const { return std::string(data_, length()); }
+	StringPiece toStringPiece() const { return StringPiece(data_, length()); }
+
+private:
+	bool grow(size_t len) {
+		size_t need = implicit_cast<size_t>(length()) + len + 1;
+		size_t cap = implicit_cast<size_t>(capacity());
+		if (cap >= implicit_cast<size_t>(MAX_LOG_LINE)) {
+			return false;
+		}
+		while (cap < need && cap < implicit_cast<size_t>(MAX_LOG_LINE)) {
+			cap *= 2;
+		}
+		cap = std::min(cap, implicit_cast<size_t>(MAX_LOG_LINE));
+
+		std::unique_ptr<char[]> heap(new char[cap]);
+		int used = length();
+		memcpy(heap.get(), data_, used);
+		releaseStorage();
+		heap_ = std::move(heap);
+		data_ = heap_.get();
+		cur_ = data_ + used;
+		end_ = data_ + cap;
+		return cap >= need;
+	}
+
+	void releaseStorage() {
+		if (storage_) {
+			storage_->giveBack(storage_ == threadLogStorage());
+			storage_ = nullptr;
+		}
+	}
+
+	ThreadLogStorage* storage_; // null when data_ is on the heap
+	char* data_;
+	char* cur_;
+	char* end_;
+	std::unique_ptr<char[]> heap_;
+}; // class LogBuffer
+
+
+/**
+* @brief Locale independent double formatting, no null terminator is written.
+* Uses Ryu based std::to_chars when available, snprintf otherwise.
+* @return bytes written to buf, 0 if buf is too small
+*/
+inline int formatDouble(char* buf, size_t size, double v, int precision = 12, FloatFormat fmt = FloatFormat::general)
+{
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+	std::to_chars_result res;
+	switch (fmt) {
+	case FloatFormat::fixed: res = std::to_chars(buf, buf + size, v, std::chars_format::fixed, precision); break;
+	case FloatFormat::scientific: res = std::to_chars(buf, buf + size, v, std::chars_format::scientific, precision); break;
+	case FloatFormat::shortest: res = std::to_chars(buf, buf + size, v); break;
+	default: res = std::to_chars(buf, buf + size, v, std::chars_format::general, precision); break;
+	}
+	return res.ec == std::errc() ? static_cast<int>(res.ptr - buf) : 0;
+#else
+	int len = 0;
+	switch (fmt) {
+	case FloatFormat::fixed: len = snprintf(buf, size, "%.*f", precision, v); break;
+	case FloatFormat::scientific: len = snprintf(buf, size, "%.*e", precision, v); break;
+	case FloatFormat::shortest: len = snprintf(buf, size, "%.17g", v); break;
+	default: len = snprintf(buf, size, "%.*g", precision, v); break;
+	}
+	return (len > 0 && static_cast<size_t>(len) < size) ? len : 0;
+#endif
 }
 
 } // namespace detail
@@ -121,7 +271,7 @@ class LogStream : noncopyable
     typedef LogStream self;
 
 public:
-    typedef detail::FixedBuffer<detail::SMALL_BUFFER> Buffer;
+    typedef detail::LogBuffer Buffer;
 
     self& operator<<(bool v) {
         //if (v) { buffer_.append("true ", 5); }
@@ -141,7 +291,7 @@ public:
 
 	self& operator<<(const void * p) {
         uintptr_t v = reinterpret_cast<uintptr_t>(p);
-        if (buffer_.avail() >= MAX_NUMERIC_SIZE) {
+        if (buffer_.ensure(MAX_NUMERIC_SIZE)) {
             char* buf = buffer_.current();
             buf[0] = '0'; buf[1] = 'x';
             size_t len = detail::convertHex(buf + 2, v);
@@ -153,8 +303,8 @@ public:
 	self& operator<<(float v) { *this << static_cast<double>(v); return *this; }
 
 	self& operator<<(double v) {
-        if (buffer_.avail() >= MAX_NUMERIC_SIZE) {
-            int len = snprintf(buffer_.current(), MAX_NUMERIC_SIZE, "%.12g", v);
+        if (buffer_.ensure(MAX_NUMERIC_SIZE)) {
+            int len = detail::formatDouble(buffer_.current(), MAX_NUMERIC_SIZE, v);
             buffer_.add(len);
         }
         return *this;
@@ -196,7 +346,7 @@ private:
 
 	template <typename T>
 	void formatInteger(T v) {
-        if (buffer_.avail() > MAX_NUMERIC_SIZE) {
+        if (buffer_.ensure(MAX_NUMERIC_SIZE)) {
             size_t len = detail::convert(buffer_.current(), v);
             buffer_.add(len);
         }
@@ -218,6 +368,15 @@ public:
         assert(static_cast<size_t>(length_) < sizeof(buf_));
     }
 
+    //! e.g. Format(3.14159, 2, FloatFormat::fixed) -> "3.14", without going through printf
+    Format(double val, int precision, FloatFormat fmt = FloatFormat::general) {
+        length_ = detail::formatDouble(buf_, sizeof(buf_) - 1, val, precision, fmt);
+        if (length_ == 0) { // too large for fixed notation
+            length_ = detail::formatDouble(buf_, sizeof(buf_) - 1, val, 17, FloatFormat::general);
+        }
+        buf_[length_] = '\0';
+    }
+
     const char* data() const { return buf_; }
     int length() const { return length_; }
 
@@ -263,7 +422,7 @@ static std::string formatSI(int64_t s)
     double n = static_cast<double>(s);
     char buf[64];
     if (s < 1000)
-        snprintf(buf, sizeof(buf), "%" PRId64, s);
+        detail::convert(buf, s);
     else if (s < 9995)
         snprintf(buf, sizeof(buf), "%.2fk", n / 1e3);
     else if (s < 99950)
@@ -322,7 +481,7 @@ static std::string formatIEC(int64_t s)
     char buf[64];
 
     if (n < Ki)
-        snprintf(buf, sizeof buf, "%" PRId64, s);
+        detail::convert(buf, s);
     else if (n < Ki * 9.995)
         snprintf(buf, sizeof buf, "%.2fKi", n / Ki);
     else if (n < Ki * 99.95)
@@ -0,0 +1,129 @@
+﻿#pragma once
+
+#include "config.h"
+#include "noncopyable.h"
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace jlib
+{
+
+/**
+* @brief Bounded multi-producer multi-consumer queue, lock free.
+* Each cell carries a sequence number telling producers and consumers whose turn it is,
+* so push and pop only contend on their own index.
+* Capacity is rounded up to a power of 2, at least 2.
+* @note http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+*/
+template <typename T>
+class BoundedMpmcQueue : noncopyable
+{
+public:
+	explicit BoundedMpmcQueue(size_t capacity)
+		: capacity_(roundUp(capacity))
+		, mask_(capacity_ - 1)
+		, cells_(new Cell[capacity_])
+		, enqueuePos_(0)
+		, dequeuePos_(0)
+	{
+		for (size_t i = 0; i < capacity_; i++) {
+			cells_[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	~BoundedMpmcQueue() {
+		T v;
+		while (tryPop(v)) {}
+	}
+
+	//! v is moved from only on success
+	bool tryPush(T& v) {
+		Cell* cell;
+		size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+		for (;;) {
+			cell = &cells_[pos & mask_];
+			size_t seq = cell->sequence.load(std::memory_order_acquire);
+			intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+			if (diff == 0) {
+				if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			} else if (diff < 0) {
+				return false; // full
+			} else {
+				pos = enqueuePos_.load(std::memory_order_relaxed);
+			}
+		}
+		::new (&cell->storage) T(std::move(v));
+		cell->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool tryPush(T&& v) { return tryPush(v); }
+
+	bool tryPop(T& v) {
+		Cell* cell;
+		size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+		for (;;) {
+			cell = &cells_[pos & mask_];
+			size_t seq = cell->sequence.load(std::memory_order_acquire);
+			intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+			if (diff == 0) {
+				if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			} else if (diff < 0) {
+				return false; // empty
+			} else {
+				pos = dequeuePos_.load(std::memory_order_relaxed);
+			}
+		}
+		T* p = reinterpret_cast<T*>(&cell->storage);
+		v = std::move(*p);
+		p->~T();
+		cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+		return true;
+	}
+
+	size_t capacity() const { return capacity_; }
+
+	//! approximate when used concurrently
+	size_t size() const {
+		size_t e = enqueuePos_.load(std::memory_order_relaxed);
+		size_t d = dequeuePos_.load(std::memory_order_relaxed);
+		return e > d ? e - d : 0;
+	}
+
+	bool empty() const { return size() == 0; }
+
+	//! total pushes / pops so far, approximate when used concurrently
+	size_t pushCount() const { return enqueuePos_.load(std::memory_order_relaxed); }
+	size_t popCount() const { return dequeuePos_.load(std::memory_order_relaxed); }
+
+private:
+	static size_t roundUp(size_t n) {
+		size_t cap = 2;
+		while (cap < n) { cap <<= 1; }
+		return cap;
+	}
+
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+	};
+
+	const size_t capacity_;
+	const size_t mask_;
+	std::unique_ptr<Cell[]> cells_;
+	alignas(64) std::atomic<size_t> enqueuePos_;
+	alignas(64) std::atomic<size_t> dequeuePos_;
+};
+
+}
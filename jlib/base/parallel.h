@@ -0,0 +1,177 @@
+﻿#pragma once
+
+#include "config.h"
+#include "threadpool.h"
+#include <assert.h>
+#include <stddef.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+/*
+* Data parallel loops on a ThreadPool, the calling thread works on chunks too.
+* Index range [begin, end) is split into chunks of grain indexes, grain 0 picks one automatically.
+* Chunks are claimed dynamically so uneven work balances out.
+* Safe to call from inside a pool task, bounded pools included: caller never waits for a helper
+* that hasn't started, nor for queue space.
+* The first exception thrown by fn stops remaining chunks and is rethrown to the caller.
+*/
+
+namespace jlib
+{
+
+namespace detail
+{
+
+//! chunks shared between caller and helpers, helpers keep it alive until they leave
+class ParallelJob
+{
+public:
+	typedef void(*ChunkFunc)(void* ctx, size_t chunk);
+
+	ParallelJob(size_t chunks, ChunkFunc func, void* ctx)
+		: chunks_(chunks), next_(0), done_(0), func_(func), ctx_(ctx)
+	{}
+
+	//! claim and run chunks until none left
+	void work() {
+		for (;;) {
+			size_t chunk = next_.fetch_add(1, std::memory_order_relaxed);
+			if (chunk >= chunks_) {
+				return;
+			}
+			if (!failed_.load(std::memory_order_relaxed)) {
+				try {
+					func_(ctx_, chunk);
+				} catch (...) {
+					std::lock_guard<std::mutex> lock(mutex_);
+					if (!error_) {
+						error_ = std::current_exception();
+					}
+					failed_ = true;
+				}
+			}
+			if (done_.fetch_add(1, std::memory_order_acq_rel) + 1 == chunks_) {
+				std::lock_guard<std::mutex> lock(mutex_);
+				cond_.notify_all();
+			}
+		}
+	}
+
+	//! wait for chunks claimed by others, rethrow first exception
+	void wait() {
+		if (done_.load(std::memory_order_acquire) != chunks_) {
+			std::unique_lock<std::mutex> lock(mutex_);
+			cond_.wait(lock, [this]() { return done_.load(std::memory_order_acquire) == chunks_; });
+		}
+		if (error_) {
+			std::rethrow_exception(error_);
+		}
+	}
+
+private:
+	const size_t chunks_;
+	std::atomic<size_t> next_;
+	std::atomic<size_t> done_;
+	std::atomic<bool> failed_{ false };
+	ChunkFunc func_;
+	void* ctx_; // caller's stack, only touched while holding an unfinished chunk
+	std::mutex mutex_;
+	std::condition_variable cond_;
+	std::exception_ptr error_;
+};
+
+//! run chunkFn(chunk) for chunk in [0, chunks) on pool and caller
+template <typename ChunkFn>
+void parallelChunks(ThreadPool& pool, size_t chunks, ChunkFn& chunkFn)
+{
+	if (chunks == 0) {
+		return;
+	}
+	auto job = std::make_shared<ParallelJob>(chunks, [](void* ctx, size_t chunk) {
+		(*static_cast<ChunkFn*>(ctx))(chunk);
+	}, &chunkFn);
+
+	// never block on a full bounded queue, every worker may be a caller nested in here;
+	// helpers that don't fit are dropped and their chunks run on the caller
+	size_t helpers = std::min(pool.threadCount(), chunks - 1);
+	for (size_t i = 0; i < helpers; i++) {
+		ThreadPool::Task task([job]() { job->work(); });
+		if (!pool.tryRun(task)) {
+			break;
+		}
+	}
+	job->work();
+	job->wait();
+}
+
+template <typename Index>
+size_t chunkCount(ThreadPool& pool, Index begin, Index end, Index& grain)
+{
+	if (end <= begin) {
+		return 0;
+	}
+	size_t n = static_cast<size_t>(end - begin);
+	if (grain <= 0) { // a few chunks per thread for balancing
+		size_t target = (pool.threadCount() + 1) * 4;
+		grain = static_cast<Index>(std::max<size_t>(1, (n + target - 1) / target));
+	}
+	size_t g = static_cast<size_t>(grain);
+	return (n + g - 1) / g;
+}
+
+} // namespace detail
+
+
+/**
+* @brief fn(i) for each i in [begin, end)
+* @param grain indexes per chunk, 0 for automatic
+*/
+template <typename Index, typename Fn>
+void parallelFor(ThreadPool& pool, Index begin, Index end, Index grain, Fn&& fn)
+{
+	static_assert(std::is_integral<Index>::value, "Index must be integral");
+	size_t chunks = detail::chunkCount(pool, begin, end, grain);
+	auto chunkFn = [&](size_t chunk) {
+		Index first = static_cast<Index>(begin + static_cast<Index>(chunk) * grain);
+		Index last = (end - first) > grain ? static_cast<Index>(first + grain) : end;
+		for (Index i = first; i < last; ++i) {
+			fn(i);
+		}
+	};
+	detail::parallelChunks(pool, chunks, chunkFn);
+}
+
+/**
+* @brief Reduce [begin, end) chunk by chunk, then combine the partial results in chunk order.
+* @param fn T fn(Index first, Index last, T init), reduces one chunk starting from init (identity)
+* @param combine T combine(T, T), need not be commutative
+* @return identity if range is empty
+*/
+template <typename Index, typename T, typename Fn, typename Combine>
+T parallelReduce(ThreadPool& pool, Index begin, Index end, Index grain, T identity, Fn&& fn, Combine&& combine)
+{
+	static_assert(std::is_integral<Index>::value, "Index must be integral");
+	size_t chunks = detail::chunkCount(pool, begin, end, grain);
+	struct Partial { T value; }; // avoids vector<bool>, chunks write concurrently
+	std::vector<Partial> partials(chunks, Partial{ identity });
+	auto chunkFn = [&](size_t chunk) {
+		Index first = static_cast<Index>(begin + static_cast<Index>(chunk) * grain);
+		Index last = (end - first) > grain ? static_cast<Index>(first + grain) : end;
+		partials[chunk].value = fn(first, last, identity);
+	};
+	detail::parallelChunks(pool, chunks, chunkFn);
+
+	T result = identity;
+	for (auto& partial : partials) {
+		result = combine(std::move(result), std::move(partial.value));
+	}
+	return result;
+}
+
+}
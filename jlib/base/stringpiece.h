@@ -37,6 +37,8 @@
 //
 // Arghh!  I wish C++ literals were automatically of type "string".
 
+#pragma once
+
 #include <string>
 #include <string.h>
 
@@ -2,11 +2,20 @@
 
 #include "config.h"
 #include "noncopyable.h"
+#include "uniquefunction.h"
+#include "future.h"
+#include "mpmcqueue.h"
+#include "histogram.h"
+#include "timerqueue.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <mutex>
 #include <condition_variable>
 #include <thread>
 #include <functional>
 #include <vector>
+#include <memory>
 #include <deque>
 #include <string>
 #include <exception>
@@ -19,7 +28,24 @@ namespace jlib
 class ThreadPool : noncopyable
 {
 public:
-	typedef std::function<void()> Task;
+	//! move-only, callables up to UniqueFunction::INLINE_SIZE bytes don't allocate
+	typedef UniqueFunction<void()> Task;
+
+	//! see metrics()
+	struct Metrics {
+		size_t queueSize = 0;
+		uint64_t blocked = 0; // run() calls that had to park for room in a bounded queue
+		uint64_t rejected = 0; // tryRun() calls refused because the queue was full
+		HistogramSnapshot queueWait = {}; // enqueue to start, ns
+		HistogramSnapshot runTime = {}; // ns
+		HistogramSnapshot queueDepth = {}; // tasks already queued in the same lane when a task was enqueued
+		std::vector<double> busyRatio = {}; // per live worker, time running tasks / time since it started
+	};
+
+	enum class LanePolicy {
+		strict,		// always take from the highest priority non-empty lane, lower lanes may starve
+		weighted,	// smooth weighted round robin over non-empty lanes
+	};
 
 	explicit ThreadPool(const std::string& name = "ThreadPool")
 		: mutex_()
@@ -27,6 +53,11 @@ public:
 		, notFull_()
 		, name_(name)
 		, maxQueueSize_(0)
+		, idleThreads_(0)
+		, blockedProducers_(0)
+		, metricsEnabled_(false)
+		, blocked_(0)
+		, rejected_(0)
 		, running_(false)
 	{}
 
@@ -36,93 +67,714 @@ public:
 		}
 	}
 
-	//! must be called before start()
+	/**
+	* @brief Bound the queue, run() blocks when full. Must be called before start().
+	* A bounded pool uses a lock free BoundedMpmcQueue, size is rounded up to power of 2,
+	* producers and workers spin a while before parking on the mutex.
+	*/
 	void setMaxQueueSize(size_t size) { maxQueueSize_ = size; }
 	//! must be called before start()
-	void setThreadInitCallback(const Task& cb) { threadInitCallback_ = cb; }
+	void setThreadInitCallback(Task cb) { threadInitCallback_ = std::move(cb); }
+	/**
+	* @brief Called in each worker with its slot before the thread init callback. Must be called before start().
+	* Slots are fixed, [0, nThreads) or [0, maxThreads) if elastic, and a regrown worker takes a retired one's slot,
+	* so per worker placement such as AffinityPolicy::workerInitCallback() doesn't drift.
+	*/
+	void setWorkerInitCallback(std::function<void(size_t slot)> cb) { workerInitCallback_ = std::move(cb); }
+	/**
+	* @brief Record queue wait, run time, queue depth and busy time per task. Must be called before start().
+	* Costs two steady_clock reads per task on the worker and one on the producer.
+	*/
+	void setMetricsEnabled(bool enabled) { metricsEnabled_ = enabled; }
+	/**
+	* @brief Let the pool grow from start(nThreads) up to maxThreads, one worker at a time,
+	* while some queued task has waited longer than growAfter, and retire workers idle for keepAlive
+	* back down to nThreads. Checks run on the pool's timer thread, which a full bounded queue doesn't block.
+	* Must be called before start().
+	*/
+	void setElastic(int maxThreads,
+					std::chrono::milliseconds growAfter = std::chrono::milliseconds(100),
+					std::chrono::milliseconds keepAlive = std::chrono::milliseconds(60000)) {
+		assert(maxThreads >= 0 && growAfter.count() > 0 && keepAlive.count() > 0);
+		maxThreads_ = static_cast<size_t>(maxThreads);
+		growAfter_ = growAfter;
+		keepAlive_ = keepAlive;
+	}
+
+	/**
+	* @brief Split the queue into lanes, lane 0 has the highest priority. Must be called before start().
+	* Tasks queued without a lane go to the last, lowest priority one, timer tasks included.
+	* weights are for LanePolicy::weighted, lane i gets lanes - i by default.
+	* In bounded mode each lane holds up to maxQueueSize tasks.
+	*/
+	void setPriorityLanes(size_t lanes, LanePolicy policy = LanePolicy::strict, std::vector<int> weights = {}) {
+		assert(lanes >= 1 && (weights.empty() || weights.size() == lanes));
+		lanes_ = lanes > 0 ? lanes : 1;
+		lanePolicy_ = policy;
+		laneWeights_ = std::move(weights);
+		if (laneWeights_.size() != lanes_) {
+			laneWeights_.clear();
+			for (size_t i = 0; i < lanes_; i++) {
+				laneWeights_.push_back(static_cast<int>(lanes_ - i));
+			}
+		}
+	}
 
 	void start(int nThreads) {
 		assert(threads_.empty());
 		running_ = true;
-		for (int i = 0; i < nThreads; i++) {
-			threads_.emplace_back(std::thread(std::bind(&ThreadPool::runInThread, this)));
+		minThreads_ = static_cast<size_t>(nThreads);
+		bool elastic = maxThreads_ > minThreads_ && nThreads > 0;
+		if (!elastic) {
+			maxThreads_ = 0; // workers read it, settle before starting them
+		}
+		size_t slots = elastic ? maxThreads_ : minThreads_;
+		taskQueues_.resize(lanes_);
+		if (maxQueueSize_ > 0) {
+			for (size_t i = 0; i < lanes_; i++) {
+				boundedQueues_.emplace_back(new BoundedMpmcQueue<Item>(maxQueueSize_));
+			}
+		}
+		if (metricsEnabled_) {
+			workerMetrics_.reset(new WorkerMetrics[slots > 0 ? slots : 1]);
 		}
-		if (nThreads == 0 && threadInitCallback_) {
-			threadInitCallback_();
+		alive_.reset(new std::atomic<bool>[slots > 0 ? slots : 1]);
+		threads_.resize(slots);
+		for (size_t i = 0; i < slots; i++) {
+			alive_[i] = false;
+			if (i < minThreads_) {
+				startWorker(i);
+			}
+		}
+		if (elastic) {
+			pushedHistory_[0] = pushedHistory_[1] = 0;
+			ticks_ = 0;
+			timerQueue().runEveryOnTimerThread(growAfter_ / 2, [this]() { adjustThreads(); });
+		}
+		if (nThreads == 0) {
+			if (workerInitCallback_) {
+				workerInitCallback_(0);
+			}
+			if (threadInitCallback_) {
+				threadInitCallback_();
+			}
 		}
 	}
 
+	//! queued tasks are discarded, producers blocked on a full queue return without queuing
 	void stop() {
 		{
+			// producers blocked on a full queue give up, their tasks are dropped
 			std::lock_guard<std::mutex> lock(mutex_);
 			running_ = false;
+			notEmpty_.notify_all();
+			notFull_.notify_all();
+		}
+		TimerQueue* timers = nullptr;
+		{
+			// kept owned so a late runAfter() from a running task doesn't create another one
+			std::lock_guard<std::mutex> lock(timerMutex_);
+			timers = timerQueue_.get();
+		}
+		if (timers) {
+			// no more timer tasks, those already queued are discarded with the rest
+			timers->stop();
 		}
-
-		notEmpty_.notify_all();
 
 		for (auto& t : threads_) {
-			t.join();
+			if (t.joinable()) {
+				t.join();
+			}
 		}
+
+		// discard what is still queued, futures of those tasks throw broken_promise
+		std::vector<std::deque<Item>> discarded(taskQueues_.size());
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			for (size_t i = 0; i < taskQueues_.size(); i++) {
+				discarded[i].swap(taskQueues_[i]);
+			}
+			queued_ = 0;
+		}
+		discarded.clear();
+		for (auto& queue : boundedQueues_) {
+			Item item;
+			while (queue->tryPop(item)) {}
+		}
+
+		std::lock_guard<std::mutex> lock(timerMutex_);
+		timerQueue_.reset();
 	}
 
 	const std::string& name() const { return name_; }
+	//! workers currently running, changes over time in an elastic pool
+	size_t threadCount() const { return liveThreads_.load(std::memory_order_relaxed); }
+
+	size_t lanes() const { return lanes_; }
 
 	size_t queueSize() const {
+		if (!boundedQueues_.empty()) {
+			size_t size = 0;
+			for (const auto& queue : boundedQueues_) {
+				size += queue->size();
+			}
+			return size;
+		}
 		std::lock_guard<std::mutex> lock(mutex_);
-		return taskQueue_.size();
+		return queued_;
+	}
+
+	/**
+	* @brief Snapshot of metrics since start(), workers keep running while it is taken.
+	* Histograms are empty unless setMetricsEnabled(true) was called.
+	*/
+	Metrics metrics() const {
+		Metrics m;
+		m.queueSize = queueSize();
+		m.blocked = blocked_.load(std::memory_order_relaxed);
+		m.rejected = rejected_.load(std::memory_order_relaxed);
+		if (!workerMetrics_) {
+			return m;
+		}
+		int64_t now = nowNs();
+		for (size_t i = 0; i < threads_.size(); i++) {
+			const auto& w = workerMetrics_[i];
+			// histograms of retired elastic workers stay in, they cover everything since start()
+			m.queueWait.merge(w.queueWait.snapshot());
+			m.runTime.merge(w.runTime.snapshot());
+			m.queueDepth.merge(w.queueDepth.snapshot());
+			if (!alive_[i].load(std::memory_order_relaxed)) { // elastic slot without a worker
+				continue;
+			}
+			int64_t busy = w.busyNs.load(std::memory_order_relaxed);
+			int64_t since = w.runningSince.load(std::memory_order_relaxed);
+			if (since > 0 && now > since) { // count the task still running
+				busy += now - since;
+			}
+			int64_t elapsed = now - w.startNs.load(std::memory_order_relaxed);
+			m.busyRatio.push_back(elapsed > 0 ? std::min(1.0, static_cast<double>(busy) / elapsed) : 0.0);
+		}
+		return m;
 	}
 
-	void run(Task task) {
+	void run(Task task) { run(std::move(task), lanes_ - 1); }
+
+	//! run task from lane, 0 being the highest priority, see setPriorityLanes()
+	void run(Task task, size_t lane) {
+		assert(lane < lanes_);
 		if (threads_.empty()) {
 			task();
+		} else if (!boundedQueues_.empty()) {
+			Item item(std::move(task));
+			stamp(item, *boundedQueues_[lane]);
+			putBounded(item, lane);
 		} else {
-			{
-				std::unique_lock<std::mutex> lock(mutex_);
-				notFull_.wait(lock, [this]() { return !isFull(); });
+			Item item(std::move(task));
+			int64_t now = metricsEnabled_ ? nowNs() : 0;
+			std::unique_lock<std::mutex> lock(mutex_);
+			notFull_.wait(lock, [this]() { return !isFull() || !running_; });
+			if (isFull()) { // stopped
+				return;
+			}
+			stamp(item, taskQueues_[lane], now);
+			taskQueues_[lane].emplace_back(std::move(item));
+			queued_++;
+			pushed_++;
+			if (idleThreads_ > 0) {
+				notEmpty_.notify_one();
 			}
+		}
+	}
 
-			std::lock_guard<std::mutex> lock(mutex_);
-			assert(!isFull());
-			taskQueue_.emplace_back(std::move(task));			
-			notEmpty_.notify_one();
+	/**
+	* @brief Like run(), but returns false instead of blocking when a bounded queue is full.
+	* task is left untouched on failure.
+	*/
+	bool tryRun(Task& task) { return tryRun(task, lanes_ - 1); }
+
+	bool tryRun(Task& task, size_t lane) {
+		if (tryPut(task, lane)) {
+			return true;
+		}
+		rejected_.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	/**
+	* @brief Run task in pool after delay, returns a handle for cancel().
+	* Timers of a pool share one timer thread, started on first use.
+	* A timer expiring while the bounded queue is full is retried every millisecond until it fits,
+	* it doesn't block the timer thread, so other timers and elastic checks keep running.
+	*/
+	template <typename Rep, typename Period>
+	TimerId runAfter(std::chrono::duration<Rep, Period> delay, Task task) {
+		return timerQueue().runAfter(delay, std::move(task));
+	}
+
+	//! run task in pool every interval, a run starts no earlier than the previous one finished
+	template <typename Rep, typename Period>
+	TimerId runEvery(std::chrono::duration<Rep, Period> interval, Task task) {
+		return timerQueue().runEvery(interval, std::move(task));
+	}
+
+	//! see TimerQueue::cancel()
+	bool cancel(TimerId id) {
+		std::lock_guard<std::mutex> lock(timerMutex_);
+		return timerQueue_ ? timerQueue_->cancel(id) : false;
+	}
+
+	/**
+	* @brief Run f in pool, result or exception thrown by f can be retrieved from the returned future.
+	* @note f must be callable with no args
+	*/
+	template <typename F>
+	auto submit(F&& f) -> Future<decltype(f())> {
+		return submit(std::forward<F>(f), lanes_ - 1);
+	}
+
+	template <typename F>
+	auto submit(F&& f, size_t lane) -> Future<decltype(f())> {
+		typedef decltype(f()) R;
+		detail::FutureStatePtr<R> state(new detail::FutureState<R>());
+		Future<R> future(state);
+		run(makeFutureTask<R>(std::move(state), std::forward<F>(f)), lane);
+		return future;
+	}
+
+	/**
+	* @brief Enqueue tasks [first, last) under one lock, waking at most one worker per task.
+	* Elements are moved from.
+	*/
+	template <typename Iter>
+	void runBatch(Iter first, Iter last) { runBatch(first, last, lanes_ - 1); }
+
+	template <typename Iter>
+	void runBatch(Iter first, Iter last, size_t lane) {
+		assert(lane < lanes_);
+		if (threads_.empty()) {
+			for (; first != last; ++first) {
+				Task task(std::move(*first));
+				task();
+			}
+			return;
+		} else if (!boundedQueues_.empty()) { // lock free already
+			for (; first != last; ++first) {
+				Item item(Task(std::move(*first)));
+				stamp(item, *boundedQueues_[lane]);
+				putBounded(item, lane);
+			}
+			return;
+		}
+
+		int64_t now = metricsEnabled_ ? nowNs() : 0;
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (first != last) {
+			notFull_.wait(lock, [this]() { return !isFull() || !running_; });
+			if (isFull()) { // stopped, the rest are dropped
+				return;
+			}
+			size_t n = 0;
+			for (; first != last && !isFull(); ++first, ++n) {
+				Item item(Task(std::move(*first)));
+				stamp(item, taskQueues_[lane], now);
+				taskQueues_[lane].emplace_back(std::move(item));
+			}
+			queued_ += n;
+			pushed_ += n;
+			wakeUp(n);
 		}
 	}
 
+	//! submit() each of [first, last) under one lock, elements are moved from
+	template <typename Iter>
+	auto submitBatch(Iter first, Iter last) -> std::vector<Future<decltype((*first)())>> {
+		typedef decltype((*first)()) R;
+		std::vector<Future<R>> futures;
+		std::vector<Task> tasks;
+		for (; first != last; ++first) {
+			detail::FutureStatePtr<R> state(new detail::FutureState<R>());
+			futures.emplace_back(state);
+			tasks.emplace_back(makeFutureTask<R>(std::move(state), std::move(*first)));
+		}
+		runBatch(tasks.begin(), tasks.end());
+		return futures;
+	}
+
+	template <typename Range>
+	auto submitBatch(Range& range) -> decltype(submitBatch(std::begin(range), std::end(range))) {
+		return submitBatch(std::begin(range), std::end(range));
+	}
+
 protected:
+	//! queued task, enqueue time and queue depth are only filled when metrics are enabled
+	struct Item {
+		Task task;
+		int64_t enqueued = 0; // steady clock ns
+		size_t depth = 0;
+
+		Item() = default;
+		explicit Item(Task&& t) : task(std::move(t)) {}
+	};
+
+	//! written by its worker only, read by metrics()
+	struct alignas(64) WorkerMetrics {
+		LogLinearHistogram queueWait;
+		LogLinearHistogram runTime;
+		LogLinearHistogram queueDepth;
+		std::atomic<int64_t> busyNs{ 0 };
+		std::atomic<int64_t> runningSince{ 0 }; // 0 when idle
+		std::atomic<int64_t> startNs{ 0 }; // rewritten when an elastic slot restarts
+	};
+
+	static int64_t nowNs() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	//! tryRun() without counting a rejection
+	bool tryPut(Task& task, size_t lane) {
+		assert(lane < lanes_);
+		if (threads_.empty()) {
+			Task t(std::move(task));
+			t();
+			return true;
+		} else if (!boundedQueues_.empty()) {
+			Item item(std::move(task));
+			stamp(item, *boundedQueues_[lane]);
+			if (boundedQueues_[lane]->tryPush(item)) {
+				notifyParked(idleThreads_, notEmpty_);
+				return true;
+			}
+			task = std::move(item.task);
+		} else {
+			std::unique_lock<std::mutex> lock(mutex_);
+			if (!isFull()) {
+				Item item(std::move(task));
+				stamp(item, taskQueues_[lane]);
+				taskQueues_[lane].emplace_back(std::move(item));
+				queued_++;
+				pushed_++;
+				if (idleThreads_ > 0) {
+					notEmpty_.notify_one();
+				}
+				return true;
+			}
+		}
+		return false;
+	}
+
+	//! queue depth only read with metrics on, the bounded queue's size() touches both contended indexes
+	template <typename Queue>
+	void stamp(Item& item, const Queue& queue, int64_t now = 0) const {
+		if (metricsEnabled_) {
+			item.enqueued = now ? now : nowNs();
+			item.depth = queue.size();
+		}
+	}
+
+	void runItem(Item& item, int worker) {
+		if (!workerMetrics_) {
+			item.task();
+			return;
+		}
+		auto& m = workerMetrics_[worker];
+		int64_t start = nowNs();
+		m.queueWait.recordExclusive(static_cast<uint64_t>(start > item.enqueued ? start - item.enqueued : 0));
+		m.queueDepth.recordExclusive(item.depth);
+		m.runningSince.store(start, std::memory_order_relaxed);
+		struct Finish { // task may throw
+			WorkerMetrics& m;
+			int64_t start;
+			~Finish() {
+				int64_t elapsed = nowNs() - start;
+				m.runningSince.store(0, std::memory_order_relaxed);
+				m.busyNs.store(m.busyNs.load(std::memory_order_relaxed) + elapsed, std::memory_order_relaxed);
+				m.runTime.recordExclusive(static_cast<uint64_t>(elapsed));
+			}
+		} finish{ m, start };
+		item.task();
+	}
+
 	bool isFull() const {
-		return maxQueueSize_ > 0 && taskQueue_.size() >= maxQueueSize_;
+		return maxQueueSize_ > 0 && queued_ >= maxQueueSize_;
+	}
+
+	static constexpr size_t NO_LANE = static_cast<size_t>(-1);
+
+	/**
+	* @brief Lane a worker should take from next, NO_LANE if all are empty.
+	* credit is the worker's own round robin state, so weighted picking needs no shared writes.
+	*/
+	template <typename NonEmpty>
+	size_t pickLane(std::vector<int>& credit, NonEmpty nonEmpty) const {
+		if (lanePolicy_ == LanePolicy::strict) {
+			for (size_t i = 0; i < lanes_; i++) {
+				if (nonEmpty(i)) {
+					return i;
+				}
+			}
+			return NO_LANE;
+		}
+		credit.resize(lanes_);
+		size_t best = NO_LANE;
+		int total = 0;
+		for (size_t i = 0; i < lanes_; i++) {
+			if (nonEmpty(i)) {
+				credit[i] += laneWeights_[i];
+				total += laneWeights_[i];
+				if (best == NO_LANE || credit[i] > credit[best]) {
+					best = i;
+				}
+			}
+		}
+		if (best != NO_LANE) {
+			credit[best] -= total;
+		}
+		return best;
+	}
+
+	//! wake min(n, idle) workers, mutex_ must be held
+	void wakeUp(size_t n) {
+		if (n == 0 || idleThreads_ == 0) {
+			return;
+		} else if (n >= idleThreads_) {
+			notEmpty_.notify_all();
+		} else {
+			for (size_t i = 0; i < n; i++) {
+				notEmpty_.notify_one();
+			}
+		}
+	}
+
+	template <typename R, typename F>
+	static Task makeFutureTask(detail::FutureStatePtr<R> state, F&& f) {
+		typedef typename std::decay<F>::type Func;
+		return Task([setter = detail::FutureSetter<R>(std::move(state)), f = Func(std::forward<F>(f))]() mutable { setter.run(f); });
 	}
 
-	Task take() {
+	/******** bounded mode, spin then park *********/
+
+	static constexpr int SPIN_COUNT = 64;
+	static constexpr int PAUSE_COUNT = 16; // pause first, then yield
+
+	static void spinWait(int i) {
+		if (i < PAUSE_COUNT) {
+			JLIB_CPU_RELAX();
+		} else {
+			std::this_thread::yield();
+		}
+	}
+
+	//! item is moved from once queued, left in place if the pool stops while waiting
+	void putBounded(Item& item, size_t lane) {
+		auto& queue = *boundedQueues_[lane];
+		for (int i = 0; i < SPIN_COUNT; i++) {
+			if (queue.tryPush(item)) {
+				notifyParked(idleThreads_, notEmpty_);
+				return;
+			}
+			spinWait(i);
+		}
+
 		{
 			std::unique_lock<std::mutex> lock(mutex_);
-			notEmpty_.wait(lock, [this]() { return !(taskQueue_.empty() && running_); });
+			blockedProducers_++;
+			blocked_.fetch_add(1, std::memory_order_relaxed);
+			notFull_.wait(lock, [this, &queue, &item]() {
+				// pairs with notifyParked(), either we see the free slot or the consumer sees us
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				return queue.tryPush(item) || !running_;
+			});
+			blockedProducers_--;
 		}
-		
-		std::lock_guard<std::mutex> lock(mutex_);
-		Task task;
-		if (!taskQueue_.empty()) {
-			task = taskQueue_.front();
-			taskQueue_.pop_front();
+		notifyParked(idleThreads_, notEmpty_);
+	}
+
+	/**
+	* @brief Park a worker on notEmpty_ until pred holds, mutex_ held by lock.
+	* Returns false if the worker has been idle for keepAlive_ and may retire from an elastic pool.
+	*/
+	template <typename Pred>
+	bool park(std::unique_lock<std::mutex>& lock, Pred pred) {
+		idleThreads_++;
+		bool stay = true;
+		if (maxThreads_ == 0) {
+			notEmpty_.wait(lock, pred);
+		} else {
+			while (stay && !notEmpty_.wait_for(lock, keepAlive_, pred)) {
+				size_t live = liveThreads_.load();
+				while (live > minThreads_ && !liveThreads_.compare_exchange_weak(live, live - 1)) {}
+				stay = live <= minThreads_;
+			}
+		}
+		idleThreads_--;
+		return stay;
+	}
+
+	bool tryPopBounded(Item& item, std::vector<int>& credit) {
+		if (lanes_ == 1) {
+			return boundedQueues_[0]->tryPop(item);
+		}
+		size_t lane = pickLane(credit, [this](size_t i) { return !boundedQueues_[i]->empty(); });
+		if (lane != NO_LANE && boundedQueues_[lane]->tryPop(item)) {
+			return true;
+		}
+		for (const auto& queue : boundedQueues_) { // lost a race, any lane will do
+			if (queue->tryPop(item)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	Item takeBounded(bool& retire, std::vector<int>& credit) {
+		Item item;
+		for (int i = 0; i < SPIN_COUNT && running_; i++) {
+			if (tryPopBounded(item, credit)) {
+				notifyParked(blockedProducers_, notFull_, lanes_ > 1);
+				return item;
+			}
+			spinWait(i);
+		}
+
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			retire = !park(lock, [this, &item, &credit]() {
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				return tryPopBounded(item, credit) || !running_;
+			});
+		}
+		if (item.task) {
+			notifyParked(blockedProducers_, notFull_, lanes_ > 1);
+		}
+		return item;
+	}
+
+	/**
+	* @brief Wake one thread parked on cond, skips the lock if nobody is parked.
+	* all wakes every one, for producers of different lanes sharing notFull_.
+	*/
+	void notifyParked(const std::atomic<size_t>& parked, std::condition_variable& cond, bool all = false) {
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (parked.load(std::memory_order_relaxed) > 0) {
+			// parked thread checks its predicate under the lock
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (all) {
+				cond.notify_all();
+			} else {
+				cond.notify_one();
+			}
+		}
+	}
+
+	//! credit is the calling worker's lane picking state
+	Item take(bool& retire, std::vector<int>& credit) {
+		if (!boundedQueues_.empty()) {
+			return takeBounded(retire, credit);
+		}
+
+		std::unique_lock<std::mutex> lock(mutex_);
+		retire = !park(lock, [this]() { return !(queued_ == 0 && running_); });
+
+		Item item;
+		size_t lane = retire || queued_ == 0 ? NO_LANE : lanes_ == 1 ? 0
+			: pickLane(credit, [this](size_t i) { return !taskQueues_[i].empty(); });
+		if (lane != NO_LANE) {
+			item = std::move(taskQueues_[lane].front());
+			taskQueues_[lane].pop_front();
+			queued_--;
+			popped_++;
 			if (maxQueueSize_ > 0) {
 				notFull_.notify_one();
 			}
 		}
-		return task;
+		return item;
+	}
+
+	TimerQueue& timerQueue() {
+		std::lock_guard<std::mutex> lock(timerMutex_);
+		if (!timerQueue_) {
+			// expired timers are queued like any task, but never block the timer thread on a full queue
+			timerQueue_.reset(new TimerQueue([this](Task& task) { return tryPut(task, lanes_ - 1); }));
+		}
+		return *timerQueue_;
+	}
+
+	/******** elastic mode *********/
+
+	void startWorker(size_t index) {
+		if (workerMetrics_) {
+			auto& m = workerMetrics_[index];
+			m.busyNs = 0;
+			m.startNs = nowNs();
+		}
+		alive_[index] = true;
+		liveThreads_++;
+		threads_[index] = std::thread(std::bind(&ThreadPool::runInThread, this, index));
+	}
+
+	//! timer thread, every growAfter_ / 2
+	void adjustThreads() {
+		for (size_t i = 0; i < threads_.size(); i++) {
+			if (!alive_[i] && threads_[i].joinable()) { // retired
+				threads_[i].join();
+			}
+		}
+
+		size_t pushed = 0, popped = 0;
+		if (!boundedQueues_.empty()) {
+			for (const auto& queue : boundedQueues_) {
+				popped += queue->popCount();
+			}
+			for (const auto& queue : boundedQueues_) {
+				pushed += queue->pushCount();
+			}
+		} else {
+			std::lock_guard<std::mutex> lock(mutex_);
+			popped = popped_;
+			pushed = pushed_;
+		}
+		// a task pushed two ticks ago is still queued, so it has waited at least growAfter_
+		size_t slot = ticks_++ % 2;
+		bool stalled = ticks_ > 2 && popped < pushedHistory_[slot] && idleThreads_ == 0;
+		pushedHistory_[slot] = pushed;
+		if (!stalled || !running_ || liveThreads_ >= maxThreads_) {
+			return;
+		}
+		for (size_t i = 0; i < threads_.size(); i++) {
+			if (!alive_[i] && !threads_[i].joinable()) {
+				startWorker(i);
+				break;
+			}
+		}
 	}
 
-	void runInThread() {
+	void runInThread(size_t index) {
+		struct Exit { // retired or stopped, adjustThreads() may join now
+			std::atomic<bool>& alive;
+			~Exit() { alive = false; }
+		} exit{ alive_[index] };
 		try {
+			if (workerInitCallback_) {
+				workerInitCallback_(index);
+			}
 			if (threadInitCallback_) {
 				threadInitCallback_();
 			}
 
+			bool retire = false;
+			std::vector<int> credit(lanes_, 0);
 			while (running_) {
-				Task task(take());
-				if (task) {
-					task();
+				Item item(take(retire, credit));
+				if (retire) {
+					break;
+				}
+				if (item.task) {
+					runItem(item, static_cast<int>(index));
 				}
 			}
+			if (!retire) {
+				liveThreads_--;
+			}
 		} catch (const std::exception & ex) {
 			fprintf(stderr, "exception caught in ThreadPool %s\n", name_.c_str());
 			fprintf(stderr, "reason: %s\n", ex.what());
@@ -139,12 +791,34 @@ private:
 	std::condition_variable notFull_;
 	std::string name_;
 	Task threadInitCallback_;
-	std::vector<std::thread> threads_;
-	std::deque<Task> taskQueue_;
+	std::function<void(size_t)> workerInitCallback_;
+	std::vector<std::thread> threads_; // one slot per possible worker, elastic slots may be empty
+	std::unique_ptr<std::atomic<bool>[]> alive_; // per slot, a worker is running in it
+	std::vector<std::deque<Item>> taskQueues_; // one per lane
+	std::vector<std::unique_ptr<BoundedMpmcQueue<Item>>> boundedQueues_; // replace taskQueues_ if maxQueueSize_ > 0
+	size_t queued_ = 0; // in all of taskQueues_
+	size_t lanes_ = 1;
+	LanePolicy lanePolicy_ = LanePolicy::strict;
+	std::vector<int> laneWeights_ = { 1 };
 	size_t maxQueueSize_;
-	bool running_;
-
-
+	std::atomic<size_t> idleThreads_; // workers waiting for tasks
+	std::atomic<size_t> blockedProducers_; // bounded mode, run() callers waiting for room
+	bool metricsEnabled_;
+	std::unique_ptr<WorkerMetrics[]> workerMetrics_; // one per thread if metricsEnabled_
+	std::atomic<uint64_t> blocked_;
+	std::atomic<uint64_t> rejected_;
+	size_t pushed_ = 0; // guarded by mutex_, with popped_ tells how long queued tasks wait
+	size_t popped_ = 0;
+	size_t minThreads_ = 0;
+	size_t maxThreads_ = 0; // 0 for a fixed size pool
+	std::chrono::milliseconds growAfter_ = {};
+	std::chrono::milliseconds keepAlive_ = {};
+	std::atomic<size_t> liveThreads_{ 0 };
+	size_t pushedHistory_[2] = {}; // timer thread only
+	size_t ticks_ = 0;
+	std::mutex timerMutex_;
+	std::unique_ptr<TimerQueue> timerQueue_; // created by the first runAfter/runEvery
+	std::atomic<bool> running_;
 };
 
 }
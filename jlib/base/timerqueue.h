@@ -0,0 +1,305 @@
+﻿#pragma once
+
+#include "config.h"
+#include "noncopyable.h"
+#include "uniquefunction.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace jlib
+{
+
+//! cancellation handle of a timer, see TimerQueue::cancel()
+struct TimerId
+{
+	uint64_t seq = 0;
+
+	bool valid() const { return seq != 0; }
+	bool operator==(const TimerId& rhs) const { return seq == rhs.seq; }
+	bool operator!=(const TimerId& rhs) const { return seq != rhs.seq; }
+};
+
+/**
+* @brief Delayed and periodic callbacks on a 4-ary min heap, served by one timer thread.
+* Expired callbacks are handed to the executor, or run on the timer thread if there is none.
+* An executor returns false, leaving the callback untouched, when it can't take it now;
+* the timer then fires again a millisecond later, so a full executor never blocks the timer thread.
+* A periodic callback is rescheduled after it finishes, so it never overlaps itself;
+* if it falls behind, the missed runs are skipped rather than run back to back.
+*/
+class TimerQueue : noncopyable
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+	typedef UniqueFunction<void()> Callback;
+	typedef UniqueFunction<bool(Callback&)> Executor;
+
+	explicit TimerQueue(Executor executor = nullptr)
+		: executor_(std::move(executor))
+		, thread_(&TimerQueue::loop, this)
+	{}
+
+	~TimerQueue() {
+		stop();
+		for (auto& kv : timers_) {
+			delete kv.second;
+		}
+	}
+
+	//! no callback fires after stop() returns, callbacks already handed to the executor still may run
+	void stop() {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (stopped_) {
+				return;
+			}
+			stopped_ = true;
+			cond_.notify_one();
+		}
+		if (thread_.joinable()) {
+			thread_.join();
+		}
+	}
+
+	TimerId runAt(Clock::time_point when, Callback cb) {
+		return add(when, Clock::duration::zero(), std::move(cb));
+	}
+
+	template <typename Rep, typename Period>
+	TimerId runAfter(std::chrono::duration<Rep, Period> delay, Callback cb) {
+		return add(Clock::now() + std::chrono::duration_cast<Clock::duration>(delay), Clock::duration::zero(), std::move(cb));
+	}
+
+	//! first run after one interval
+	template <typename Rep, typename Period>
+	TimerId runEvery(std::chrono::duration<Rep, Period> interval, Callback cb) {
+		auto d = std::chrono::duration_cast<Clock::duration>(interval);
+		assert(d > Clock::duration::zero());
+		return add(Clock::now() + d, d, std::move(cb));
+	}
+
+	//! like runEvery(), but cb runs on the timer thread itself, so it must be short and never block
+	template <typename Rep, typename Period>
+	TimerId runEveryOnTimerThread(std::chrono::duration<Rep, Period> interval, Callback cb) {
+		auto d = std::chrono::duration_cast<Clock::duration>(interval);
+		assert(d > Clock::duration::zero());
+		return add(Clock::now() + d, d, std::move(cb), true);
+	}
+
+	/**
+	* @brief Prevent future runs of timer, returns false if it already finished or was cancelled.
+	* A run already handed to the executor is skipped if it has not started yet.
+	* A run in progress is not waited for, so it is safe to cancel a timer from its own callback.
+	*/
+	bool cancel(TimerId id) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		auto iter = timers_.find(id.seq);
+		if (iter == timers_.end() || iter->second->cancelled) {
+			return false;
+		}
+		Timer* timer = iter->second;
+		if (timer->heapIndex == NOT_IN_HEAP) { // dispatched, its task deletes it when done
+			timer->cancelled = true;
+			return true;
+		}
+		removeAt(timer->heapIndex);
+		timers_.erase(iter);
+		delete timer;
+		return true;
+	}
+
+	//! timers waiting to fire
+	size_t size() const {
+		std::lock_guard<std::mutex> lock(mutex_);
+		return heap_.size();
+	}
+
+private:
+	static constexpr size_t NOT_IN_HEAP = static_cast<size_t>(-1);
+	static constexpr size_t ARITY = 4; // shallower than binary, children share a cache line
+
+	struct Timer {
+		Clock::time_point when;
+		Clock::duration interval; // zero for one shot
+		uint64_t seq;
+		size_t heapIndex = NOT_IN_HEAP;
+		bool onTimerThread = false;
+		std::atomic<bool> cancelled{ false };
+		Callback cb;
+	};
+
+	static bool before(const Timer* a, const Timer* b) {
+		return a->when < b->when || (a->when == b->when && a->seq < b->seq);
+	}
+
+	TimerId add(Clock::time_point when, Clock::duration interval, Callback cb, bool onTimerThread = false) {
+		Timer* timer = new Timer();
+		timer->when = when;
+		timer->interval = interval;
+		timer->onTimerThread = onTimerThread;
+		timer->cb = std::move(cb);
+		std::lock_guard<std::mutex> lock(mutex_);
+		timer->seq = ++lastSeq_;
+		timers_[timer->seq] = timer;
+		if (push(timer)) {
+			cond_.notify_one();
+		}
+		return TimerId{ timer->seq };
+	}
+
+	/******** 4-ary heap, mutex_ must be held *********/
+
+	//! returns true if timer became the earliest
+	bool push(Timer* timer) {
+		heap_.push_back(timer);
+		timer->heapIndex = heap_.size() - 1;
+		siftUp(timer->heapIndex);
+		return timer->heapIndex == 0;
+	}
+
+	void place(Timer* timer, size_t i) {
+		heap_[i] = timer;
+		timer->heapIndex = i;
+	}
+
+	void siftUp(size_t i) {
+		Timer* timer = heap_[i];
+		while (i > 0) {
+			size_t parent = (i - 1) / ARITY;
+			if (!before(timer, heap_[parent])) {
+				break;
+			}
+			place(heap_[parent], i);
+			i = parent;
+		}
+		place(timer, i);
+	}
+
+	void siftDown(size_t i) {
+		Timer* timer = heap_[i];
+		const size_t n = heap_.size();
+		for (;;) {
+			size_t first = i * ARITY + 1;
+			if (first >= n) {
+				break;
+			}
+			size_t last = first + ARITY < n ? first + ARITY : n;
+			size_t min = first;
+			for (size_t c = first + 1; c < last; c++) {
+				if (before(heap_[c], heap_[min])) {
+					min = c;
+				}
+			}
+			if (!before(heap_[min], timer)) {
+				break;
+			}
+			place(heap_[min], i);
+			i = min;
+		}
+		place(timer, i);
+	}
+
+	void removeAt(size_t i) {
+		heap_[i]->heapIndex = NOT_IN_HEAP;
+		Timer* last = heap_.back();
+		heap_.pop_back();
+		if (i < heap_.size()) {
+			place(last, i);
+			siftDown(i);
+			siftUp(last->heapIndex);
+		}
+	}
+
+	/******** timer thread *********/
+
+	void loop() {
+		std::vector<Timer*> expired;
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (!stopped_) {
+			if (heap_.empty()) {
+				cond_.wait(lock);
+				continue;
+			}
+			auto now = Clock::now();
+			if (heap_[0]->when > now) {
+				auto when = heap_[0]->when; // copied, cancel() may delete the timer while we wait
+				cond_.wait_until(lock, when);
+				continue;
+			}
+			while (!heap_.empty() && heap_[0]->when <= now) {
+				expired.push_back(heap_[0]);
+				removeAt(0);
+			}
+			lock.unlock();
+			for (Timer* timer : expired) {
+				fire(timer);
+			}
+			expired.clear();
+			lock.lock();
+		}
+	}
+
+	void fire(Timer* timer) {
+		Callback task([this, timer]() {
+			if (!timer->cancelled) {
+				timer->cb();
+			}
+			finish(timer);
+		});
+		if (!executor_ || timer->onTimerThread) {
+			task();
+		} else if (!executor_(task)) {
+			retry(timer);
+		}
+	}
+
+	//! executor refused the run, try again shortly unless cancelled meanwhile
+	void retry(Timer* timer) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (timer->cancelled || stopped_) {
+			timers_.erase(timer->seq);
+			delete timer;
+			return;
+		}
+		timer->when = Clock::now() + std::chrono::milliseconds(1);
+		push(timer); // on the timer thread, loop() looks at the heap again before waiting
+	}
+
+	//! reschedule a periodic timer after its run, or forget it
+	void finish(Timer* timer) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (timer->interval != Clock::duration::zero() && !timer->cancelled && !stopped_) {
+			auto now = Clock::now();
+			timer->when += timer->interval;
+			if (timer->when <= now) { // fell behind, skip missed runs
+				timer->when = now + timer->interval;
+			}
+			if (push(timer)) {
+				cond_.notify_one();
+			}
+			return;
+		}
+		timers_.erase(timer->seq);
+		delete timer;
+	}
+
+	Executor executor_;
+	mutable std::mutex mutex_ = {};
+	std::condition_variable cond_ = {};
+	std::vector<Timer*> heap_ = {};
+	std::unordered_map<uint64_t, Timer*> timers_ = {}; // owns all timers, in heap or running
+	uint64_t lastSeq_ = 0;
+	bool stopped_ = false;
+	std::thread thread_;
+};
+
+}
@@ -0,0 +1,176 @@
+﻿#pragma once
+
+#include "config.h"
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <functional> // std::bad_function_call
+
+namespace jlib
+{
+
+template <typename Signature>
+class UniqueFunction;
+
+/**
+* @brief Move-only std::function, like C++23 std::move_only_function.
+* Callables up to INLINE_SIZE bytes that are nothrow movable are stored inline without allocating,
+* larger ones go to heap. Whole object is one cache line.
+* Accepts move-only callables, e.g. lambdas capturing std::unique_ptr.
+*/
+template <typename R, typename... Args>
+class UniqueFunction<R(Args...)>
+{
+public:
+	static constexpr size_t INLINE_ALIGN = alignof(std::max_align_t);
+	static constexpr size_t INLINE_SIZE = 64 - INLINE_ALIGN;
+
+	UniqueFunction() noexcept : ops_(nullptr) {}
+	UniqueFunction(std::nullptr_t) noexcept : ops_(nullptr) {}
+
+	template <typename F, typename D = typename std::decay<F>::type,
+		typename = typename std::enable_if<!std::is_same<D, UniqueFunction>::value>::type>
+	UniqueFunction(F&& f) : ops_(nullptr) {
+		if (isNull(f)) { return; }
+		construct<D>(std::forward<F>(f), std::integral_constant<bool, fitsInline<D>()>());
+	}
+
+	UniqueFunction(UniqueFunction&& rhs) noexcept : ops_(rhs.ops_) {
+		if (ops_) {
+			ops_->move(&storage_, &rhs.storage_);
+			rhs.ops_ = nullptr;
+		}
+	}
+
+	UniqueFunction& operator=(UniqueFunction&& rhs) noexcept {
+		if (this != &rhs) {
+			reset();
+			if (rhs.ops_) {
+				rhs.ops_->move(&storage_, &rhs.storage_);
+				ops_ = rhs.ops_;
+				rhs.ops_ = nullptr;
+			}
+		}
+		return *this;
+	}
+
+	UniqueFunction& operator=(std::nullptr_t) noexcept { reset(); return *this; }
+
+	template <typename F, typename D = typename std::decay<F>::type,
+		typename = typename std::enable_if<!std::is_same<D, UniqueFunction>::value>::type>
+	UniqueFunction& operator=(F&& f) {
+		UniqueFunction(std::forward<F>(f)).swap(*this);
+		return *this;
+	}
+
+	UniqueFunction(const UniqueFunction&) = delete;
+	UniqueFunction& operator=(const UniqueFunction&) = delete;
+
+	~UniqueFunction() { reset(); }
+
+	explicit operator bool() const noexcept { return ops_ != nullptr; }
+
+	R operator()(Args... args) {
+		if (!ops_) { throw std::bad_function_call(); }
+		return ops_->invoke(&storage_, std::forward<Args>(args)...);
+	}
+
+	void swap(UniqueFunction& rhs) noexcept {
+		UniqueFunction tmp(std::move(rhs));
+		rhs = std::move(*this);
+		*this = std::move(tmp);
+	}
+
+private:
+	typedef typename std::aligned_storage<INLINE_SIZE, INLINE_ALIGN>::type Storage;
+
+	struct Ops
+	{
+		R(*invoke)(void* storage, Args&&... args);
+		//! move construct dst from src, destroys src
+		void(*move)(void* dst, void* src) noexcept;
+		void(*destroy)(void* storage) noexcept;
+	};
+
+	template <typename D>
+	static constexpr bool fitsInline() {
+		return sizeof(D) <= INLINE_SIZE && alignof(D) <= INLINE_ALIGN && std::is_nothrow_move_constructible<D>::value;
+	}
+
+	// a function reference is never null, comparing it warns
+	template <typename F>
+	static bool isNull(const F& f) { return isNullImpl(f, std::is_function<F>(), 0); }
+	template <typename F>
+	static bool isNullImpl(const F&, std::true_type, int) { return false; }
+	template <typename F>
+	static auto isNullImpl(const F& f, std::false_type, int) -> decltype(f == nullptr) { return f == nullptr; }
+	template <typename F>
+	static bool isNullImpl(const F&, std::false_type, long) { return false; }
+
+	// inline storage
+	template <typename D>
+	struct InlineOps
+	{
+		static R invoke(void* storage, Args&&... args) {
+			return (*static_cast<D*>(storage))(std::forward<Args>(args)...);
+		}
+		static void move(void* dst, void* src) noexcept {
+			::new (dst) D(std::move(*static_cast<D*>(src)));
+			static_cast<D*>(src)->~D();
+		}
+		static void destroy(void* storage) noexcept { static_cast<D*>(storage)->~D(); }
+		static const Ops ops;
+	};
+
+	// heap storage, storage holds D*
+	template <typename D>
+	struct HeapOps
+	{
+		static D*& ptr(void* storage) { return *static_cast<D**>(storage); }
+		static R invoke(void* storage, Args&&... args) {
+			return (*ptr(storage))(std::forward<Args>(args)...);
+		}
+		static void move(void* dst, void* src) noexcept { ::new (dst) D*(ptr(src)); }
+		static void destroy(void* storage) noexcept { delete ptr(storage); }
+		static const Ops ops;
+	};
+
+	template <typename D, typename F>
+	void construct(F&& f, std::true_type) {
+		::new (&storage_) D(std::forward<F>(f));
+		ops_ = &InlineOps<D>::ops;
+	}
+
+	template <typename D, typename F>
+	void construct(F&& f, std::false_type) {
+		::new (&storage_) D*(new D(std::forward<F>(f)));
+		ops_ = &HeapOps<D>::ops;
+	}
+
+	void reset() noexcept {
+		if (ops_) {
+			ops_->destroy(&storage_);
+			ops_ = nullptr;
+		}
+	}
+
+	Storage storage_;
+	const Ops* ops_;
+};
+
+static_assert(sizeof(UniqueFunction<void()>) == 64, "UniqueFunction should be one cache line");
+
+template <typename R, typename... Args>
+template <typename D>
+const typename UniqueFunction<R(Args...)>::Ops UniqueFunction<R(Args...)>::InlineOps<D>::ops = {
+	&InlineOps<D>::invoke, &InlineOps<D>::move, &InlineOps<D>::destroy
+};
+
+template <typename R, typename... Args>
+template <typename D>
+const typename UniqueFunction<R(Args...)>::Ops UniqueFunction<R(Args...)>::HeapOps<D>::ops = {
+	&HeapOps<D>::invoke, &HeapOps<D>::move, &HeapOps<D>::destroy
+};
+
+}
@@ -0,0 +1,375 @@
+﻿#pragma once
+
+#include "config.h"
+#include "noncopyable.h"
+#include "uniquefunction.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+namespace jlib
+{
+
+namespace detail
+{
+
+/**
+* @brief Chase-Lev work stealing deque, T must be trivially copyable, e.g. a pointer.
+* Owner thread push()/pop() at bottom, any thread steal() at top.
+* Arrays grow on demand, old arrays are kept until destruction since thieves may still read them.
+* @note "Correct and Efficient Work-Stealing for Weak Memory Models", Lê et al. PPoPP'13
+*/
+template <typename T>
+class ChaseLevDeque : noncopyable
+{
+	struct Array
+	{
+		explicit Array(int64_t capacity)
+			: capacity_(capacity)
+			, mask_(capacity - 1)
+			, buf_(new std::atomic<T>[static_cast<size_t>(capacity)])
+		{
+			assert((capacity & mask_) == 0);
+		}
+
+		int64_t capacity() const { return capacity_; }
+		T get(int64_t i) const { return buf_[i & mask_].load(std::memory_order_relaxed); }
+		void put(int64_t i, T x) { buf_[i & mask_].store(x, std::memory_order_relaxed); }
+
+		Array* grow(int64_t bottom, int64_t top) const {
+			Array* a = new Array(capacity_ * 2);
+			for (int64_t i = top; i != bottom; i++) {
+				a->put(i, get(i));
+			}
+			return a;
+		}
+
+	private:
+		int64_t capacity_;
+		int64_t mask_;
+		std::unique_ptr<std::atomic<T>[]> buf_;
+	};
+
+public:
+	explicit ChaseLevDeque(int64_t capacity = 256)
+		: top_(0)
+		, bottom_(0)
+		, array_(new Array(capacity))
+	{
+		arrays_.emplace_back(array_.load(std::memory_order_relaxed));
+	}
+
+	//! owner only
+	void push(T x) {
+		int64_t b = bottom_.load(std::memory_order_relaxed);
+		int64_t t = top_.load(std::memory_order_acquire);
+		Array* a = array_.load(std::memory_order_relaxed);
+		if (b - t > a->capacity() - 1) {
+			a = a->grow(b, t);
+			arrays_.emplace_back(a);
+			array_.store(a, std::memory_order_release);
+		}
+		a->put(b, x);
+		std::atomic_thread_fence(std::memory_order_release);
+		bottom_.store(b + 1, std::memory_order_relaxed);
+	}
+
+	//! owner only, T() if empty
+	T pop() {
+		int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+		Array* a = array_.load(std::memory_order_relaxed);
+		bottom_.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t t = top_.load(std::memory_order_relaxed);
+		T x = T();
+		if (t <= b) {
+			x = a->get(b);
+			if (t == b) { // last one, race with thieves
+				if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+					x = T();
+				}
+				bottom_.store(b + 1, std::memory_order_relaxed);
+			}
+		} else {
+			bottom_.store(b + 1, std::memory_order_relaxed);
+		}
+		return x;
+	}
+
+	//! any thread, T() if empty or lost the race to another thief
+	T steal() {
+		int64_t t = top_.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t b = bottom_.load(std::memory_order_acquire);
+		if (t < b) {
+			T x = array_.load(std::memory_order_acquire)->get(t);
+			if (top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+				return x;
+			}
+		}
+		return T();
+	}
+
+	//! approximate
+	size_t size() const {
+		int64_t b = bottom_.load(std::memory_order_relaxed);
+		int64_t t = top_.load(std::memory_order_relaxed);
+		return b > t ? static_cast<size_t>(b - t) : 0;
+	}
+
+	bool empty() const { return size() == 0; }
+
+private:
+	alignas(64) std::atomic<int64_t> top_;
+	alignas(64) std::atomic<int64_t> bottom_;
+	std::atomic<Array*> array_;
+	std::vector<std::unique_ptr<Array>> arrays_; // owner only
+};
+
+} // namespace detail
+
+
+/**
+* @brief Work stealing thread pool, a drop-in for ThreadPool when many workers contend on its lock.
+* Tasks run() from a worker go to that worker's own deque (LIFO for the owner, FIFO for thieves),
+* tasks from other threads go to a global injection queue.
+* Idle workers spin through the queues briefly, then park; submitters only wake a worker when one is parked.
+* Like ThreadPool, tasks still queued when stop() is called are discarded.
+*/
+class WorkStealingPool : noncopyable
+{
+public:
+	//! move-only, callables up to UniqueFunction::INLINE_SIZE bytes don't allocate
+	typedef UniqueFunction<void()> Task;
+
+	explicit WorkStealingPool(const std::string& name = "WorkStealingPool")
+		: name_(name)
+		, running_(false)
+		, injectionSize_(0)
+		, sleepers_(0)
+		, epoch_(0)
+	{}
+
+	~WorkStealingPool() {
+		if (running_) {
+			stop();
+		}
+	}
+
+	//! must be called before start()
+	void setThreadInitCallback(Task cb) { threadInitCallback_ = std::move(cb); }
+
+	void start(int nThreads) {
+		assert(threads_.empty());
+		running_ = true;
+		for (int i = 0; i < nThreads; i++) {
+			workers_.emplace_back(new Worker());
+		}
+		for (int i = 0; i < nThreads; i++) {
+			threads_.emplace_back(std::thread(std::bind(&WorkStealingPool::runInThread, this, i)));
+		}
+		if (nThreads == 0 && threadInitCallback_) {
+			threadInitCallback_();
+		}
+	}
+
+	void stop() {
+		{
+			std::lock_guard<std::mutex> lock(parkMutex_);
+			running_ = false;
+			epoch_++;
+		}
+		parkCond_.notify_all();
+
+		for (auto& t : threads_) {
+			t.join();
+		}
+
+		// discard leftovers
+		for (auto& w : workers_) {
+			while (Task* task = w->deque.pop()) { delete task; }
+		}
+		std::lock_guard<std::mutex> lock(injectionMutex_);
+		for (auto task : injection_) { delete task; }
+		injection_.clear();
+		injectionSize_ = 0;
+	}
+
+	const std::string& name() const { return name_; }
+
+	//! approximate when workers are running
+	size_t queueSize() const {
+		size_t n = injectionSize_.load(std::memory_order_relaxed);
+		for (auto& w : workers_) {
+			n += w->deque.size();
+		}
+		return n;
+	}
+
+	void run(Task task) {
+		if (threads_.empty()) {
+			task();
+			return;
+		}
+
+		Task* t = new Task(std::move(task));
+		Worker* self = currentWorker();
+		if (self && self->pool == this) {
+			self->deque.push(t);
+		} else {
+			std::lock_guard<std::mutex> lock(injectionMutex_);
+			injection_.push_back(t);
+			injectionSize_.fetch_add(1, std::memory_order_relaxed);
+		}
+		// pairs with the fence in park(), either we see the sleeper or it sees the task
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		wakeOne();
+	}
+
+private:
+	struct Worker
+	{
+		detail::ChaseLevDeque<Task*> deque;
+		WorkStealingPool* pool = nullptr;
+		uint32_t seed = 0;
+	};
+
+	static Worker*& currentWorker() {
+		thread_local Worker* worker = nullptr;
+		return worker;
+	}
+
+	void wakeOne() {
+		if (sleepers_.load(std::memory_order_seq_cst) > 0) {
+			{
+				std::lock_guard<std::mutex> lock(parkMutex_);
+				epoch_++;
+			}
+			parkCond_.notify_one();
+		}
+	}
+
+	Task* popInjection() {
+		if (injectionSize_.load(std::memory_order_relaxed) == 0) {
+			return nullptr;
+		}
+		std::lock_guard<std::mutex> lock(injectionMutex_);
+		if (injection_.empty()) {
+			return nullptr;
+		}
+		Task* task = injection_.front();
+		injection_.pop_front();
+		injectionSize_.fetch_sub(1, std::memory_order_relaxed);
+		return task;
+	}
+
+	Task* steal(Worker* self) {
+		size_t n = workers_.size();
+		// xorshift, start from a random victim so thieves spread out
+		self->seed ^= self->seed << 13; self->seed ^= self->seed >> 17; self->seed ^= self->seed << 5;
+		size_t start = self->seed % n;
+		for (size_t i = 0; i < n; i++) {
+			Worker* victim = workers_[(start + i) % n].get();
+			if (victim != self) {
+				if (Task* task = victim->deque.steal()) {
+					return task;
+				}
+			}
+		}
+		return nullptr;
+	}
+
+	Task* findTask(Worker* self) {
+		if (Task* task = self->deque.pop()) {
+			return task;
+		}
+		Task* task = popInjection();
+		if (!task) {
+			task = steal(self);
+		}
+		if (task && sleepers_.load(std::memory_order_relaxed) > 0 && queueSize() > 0) {
+			wakeOne(); // more work out there, bring in help
+		}
+		return task;
+	}
+
+	void park() {
+		uint64_t epoch;
+		{
+			std::lock_guard<std::mutex> lock(parkMutex_);
+			epoch = epoch_;
+		}
+		sleepers_.fetch_add(1, std::memory_order_seq_cst);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (queueSize() == 0) {
+			std::unique_lock<std::mutex> lock(parkMutex_);
+			parkCond_.wait(lock, [this, epoch]() { return epoch_ != epoch || !running_; });
+		}
+		sleepers_.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	void runInThread(int index) {
+		Worker* self = workers_[index].get();
+		self->pool = this;
+		self->seed = static_cast<uint32_t>(index) * 2654435761u + 1;
+		currentWorker() = self;
+		try {
+			if (threadInitCallback_) {
+				threadInitCallback_();
+			}
+
+			static constexpr int SPIN_ROUNDS = 64;
+			int idle = 0;
+			while (running_) {
+				Task* task = findTask(self);
+				if (task) {
+					idle = 0;
+					std::unique_ptr<Task> guard(task);
+					(*task)();
+				} else if (++idle < SPIN_ROUNDS) {
+					std::this_thread::yield();
+				} else {
+					idle = 0;
+					park();
+				}
+			}
+		} catch (const std::exception & ex) {
+			fprintf(stderr, "exception caught in WorkStealingPool %s\n", name_.c_str());
+			fprintf(stderr, "reason: %s\n", ex.what());
+			abort();
+		} catch (...) {
+			fprintf(stderr, "unknown exception caught in WorkStealingPool %s\n", name_.c_str());
+			throw; // rethrow
+		}
+		currentWorker() = nullptr;
+	}
+
+private:
+	std::string name_;
+	Task threadInitCallback_;
+	std::vector<std::thread> threads_;
+	std::vector<std::unique_ptr<Worker>> workers_;
+	std::atomic<bool> running_;
+
+	std::mutex injectionMutex_;
+	std::deque<Task*> injection_;
+	std::atomic<size_t> injectionSize_;
+
+	std::mutex parkMutex_;
+	std::condition_variable parkCond_;
+	std::atomic<int> sleepers_;
+	uint64_t epoch_; // guarded by parkMutex_, bumped on every wakeup
+};
+
+}
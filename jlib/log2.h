@@ -14,9 +14,15 @@
 #endif // JLIB_WINDOWS
 
 #include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include "base/logsampling.h"
 
 #define SPDLOG_HEADER_ONLY
 #include <spdlog/spdlog.h>
+#include <spdlog/async.h>
 #include <spdlog/sinks/daily_file_sink.h>
 #include <spdlog/sinks/stdout_color_sinks.h>
 
@@ -27,13 +33,77 @@
 namespace jlib {
     
 static constexpr char g_logger_name[] = "jlogger";
+
+struct logger_options
+{
+	//! use spdlog::async_logger, messages are formatted on caller thread and written by a backend thread
+	bool async = false;
+	//! async only, max messages in queue, shared by all async loggers
+	size_t queue_size = 8192;
+	//! async only, block caller or drop oldest message when queue is full
+	spdlog::async_overflow_policy overflow_policy = spdlog::async_overflow_policy::block;
+	//! async only, backend threads
+	size_t thread_count = 1;
+	//! flush immediately on messages of this level or above, trace flushes every message
+	spdlog::level::level_enum flush_on = spdlog::level::trace;
+	//! flush periodically, 0 to disable
+	std::chrono::seconds flush_every = std::chrono::seconds(0);
+
+	//! async logger flushing on error or every 3 seconds
+	static logger_options async_default() {
+		logger_options opt;
+		opt.async = true;
+		opt.flush_on = spdlog::level::err;
+		opt.flush_every = std::chrono::seconds(3);
+		return opt;
+	}
+};
+
+namespace detail {
+
+/**
+* @brief Logger used by JLOG_*, so they don't look up the registry on each line.
+* owner keeps it alive even if spdlog::drop()/drop_all() removes it from the registry,
+* ptr is the lock free fast path into owner.
+*/
+struct logger_cache
+{
+	std::mutex mutex;
+	std::shared_ptr<spdlog::logger> owner;
+	std::atomic<spdlog::logger*> ptr{ nullptr };
+};
+
+inline logger_cache& cached_logger() {
+	static logger_cache cache;
+	return cache;
+}
+
+inline spdlog::logger* cache_logger(std::shared_ptr<spdlog::logger> logger) {
+	auto& cache = cached_logger();
+	std::lock_guard<std::mutex> lock(cache.mutex);
+	cache.owner = std::move(logger);
+	cache.ptr.store(cache.owner.get(), std::memory_order_release);
+	return cache.owner.get();
+}
+
+}
+
+inline spdlog::logger* get_logger() {
+	auto logger = detail::cached_logger().ptr.load(std::memory_order_acquire);
+	if (JLIB_LIKELY(logger)) {
+		return logger;
+	}
+	// registered by someone else, cache it so the pointer outlives this call
+	return detail::cache_logger(spdlog::get(g_logger_name));
+}
     
 inline void init_logger( 
 #ifdef JLIB_WINDOWS
-std::wstring file_name = L""
+std::wstring file_name = L"",
 #else
-std::string file_name = ""
+std::string file_name = "",
 #endif
+const logger_options& opt = logger_options()
 )
 {
 	if (!file_name.empty()) {
@@ -49,14 +119,25 @@ std::string file_name = ""
 #ifdef JLIB_WINDOWS
 		sinks.push_back(std::make_shared<spdlog::sinks::msvc_sink_mt>());
 #endif
-		sinks.push_back(std::make_shared<spdlog::sinks::wincolor_stdout_sink_mt>());
+		sinks.push_back(std::make_shared<spdlog::sinks::stdout_color_sink_mt>());
 		if (!file_name.empty()) {
 			sinks.push_back(std::make_shared<spdlog::sinks::daily_file_sink_mt>(file_name, 23, 59));
 		}
-		auto combined_logger = std::make_shared<spdlog::logger>(g_logger_name, begin(sinks), end(sinks));
+		std::shared_ptr<spdlog::logger> combined_logger;
+		if (opt.async) {
+			spdlog::init_thread_pool(opt.queue_size, opt.thread_count);
+			combined_logger = std::make_shared<spdlog::async_logger>(g_logger_name, begin(sinks), end(sinks), 
+																	 spdlog::thread_pool(), opt.overflow_policy);
+		} else {
+			combined_logger = std::make_shared<spdlog::logger>(g_logger_name, begin(sinks), end(sinks));
+		}
 		combined_logger->set_pattern("[%Y-%m-%d %H:%M:%S.%e] [%t] [%L] %v");
 		spdlog::register_logger(combined_logger);
-		combined_logger->flush_on(spdlog::level::trace);
+		combined_logger->flush_on(opt.flush_on);
+		if (opt.flush_every.count() > 0) {
+			spdlog::flush_every(opt.flush_every);
+		}
+		detail::cache_logger(combined_logger);
 	} catch (const spdlog::spdlog_ex& ex) {
 #ifdef JLIB_WINDOWS
 		char msg[1024] = { 0 };
@@ -69,19 +150,39 @@ std::string file_name = ""
 	}    
 }
 
+/**
+* @brief Flush and drop the logger, must be called before exit when async to not lose queued messages.
+* The only way to release the logger JLOG_* use, no thread may log concurrently.
+*/
+inline void shutdown_logger()
+{
+	detail::cache_logger(nullptr);
+	spdlog::shutdown();
+}
+
 
-#define JLOG_DBUG spdlog::get(jlib::g_logger_name)->debug
-#define JLOG_INFO spdlog::get(jlib::g_logger_name)->info
-#define JLOG_WARN spdlog::get(jlib::g_logger_name)->warn
-#define JLOG_ERRO spdlog::get(jlib::g_logger_name)->error
-#define JLOG_CRTC spdlog::get(jlib::g_logger_name)->critical
+#define JLOG_DBUG jlib::get_logger()->debug
+#define JLOG_INFO jlib::get_logger()->info
+#define JLOG_WARN jlib::get_logger()->warn
+#define JLOG_ERRO jlib::get_logger()->error
+#define JLOG_CRTC jlib::get_logger()->critical
 
 #ifdef JLIB_WINDOWS
-#define JLOG_ALL(args, ...) spdlog::get(jlib::g_logger_name)->log(spdlog::level::off, args, __VA_ARGS__)
+#define JLOG_ALL(args, ...) jlib::get_logger()->log(spdlog::level::off, args, __VA_ARGS__)
 #else
-#define JLOG_ALL(args...) spdlog::get(jlib::g_logger_name)->log(spdlog::level::off, args)
+#define JLOG_ALL(args...) jlib::get_logger()->log(spdlog::level::off, args)
 #endif /* JLIB_WINDOWS */
 
+/*
+* Rate limited JLOG_*, counted per call site, e.g.
+*   JLOG_EVERY_N(WARN, 100)("logged on occurrence 1, 101, 201 ... #{}", fd);
+*   JLOG_FIRST_N(ERRO, 10)("logged 10 times at most");
+*   JLOG_EVERY_T(CRTC, 1000)("logged once a second at most");
+*/
+#define JLOG_EVERY_N(level, n) JLIB_LOG_IF_EVERY_N(n) JLOG_##level
+#define JLOG_FIRST_N(level, n) JLIB_LOG_IF_FIRST_N(n) JLOG_##level
+#define JLOG_EVERY_T(level, ms) JLIB_LOG_IF_EVERY_T(ms) JLOG_##level
+
 class range_log
 {
 private:
@@ -141,7 +242,7 @@ inline void dump_hex(const void* buff, size_t buff_len, spdlog::level::level_enu
 		}
 	}
 
-	spdlog::get(jlib::g_logger_name)->log(level_enum, output);
+	jlib::get_logger()->log(level_enum, output);
 }
 
 inline void dump_asc(const void* buff, size_t buff_len, bool seperate_with_space = true, bool force_new_line = true, spdlog::level::level_enum level_enum = spdlog::level::warn)
@@ -185,7 +286,7 @@ inline void dump_asc(const void* buff, size_t buff_len, bool seperate_with_space
 		}
 	}
 
-	spdlog::get(jlib::g_logger_name)->log(level_enum, output);
+	jlib::get_logger()->log(level_enum, output);
 }
 
 #define JLOG_HEX(b, l) jlib::dump_hex((b), (l))
@@ -5,12 +5,16 @@
 
 #ifndef JLIB_LOG2_ENABLED
 #define init_logger
+#define shutdown_logger
 #define JLOG_DBUG
 #define JLOG_INFO
 #define JLOG_WARN
 #define JLOG_ERRO
 #define JLOG_CRTC
 #define JLOG_ALL
+#define JLOG_EVERY_N(level, n) if (false) JLOG_##level
+#define JLOG_FIRST_N(level, n) if (false) JLOG_##level
+#define JLOG_EVERY_T(level, ms) if (false) JLOG_##level
 
 class range_log {
 public:
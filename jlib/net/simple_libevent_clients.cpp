@@ -29,12 +29,16 @@
 # endif
 #else // JLIB_DISABLE_LOG
 #define init_logger(...)
+#define shutdown_logger(...)
 #define JLOG_DBUG(...)
 #define JLOG_INFO(...)
 #define JLOG_WARN(...)
 #define JLOG_ERRO(...)
 #define JLOG_CRTC(...)
 #define JLOG_ALL(...)
+#define JLOG_EVERY_N(level, n) if (false) JLOG_##level
+#define JLOG_FIRST_N(level, n) if (false) JLOG_##level
+#define JLOG_EVERY_T(level, ms) if (false) JLOG_##level
 
 class range_log {
 public:
@@ -307,7 +311,7 @@ struct simple_libevent_clients::PrivateImpl
 				if (iter != context->clients.end()) {
 					client = iter->second;
 				} else {
-					JLOG_CRTC("eventcb cannot find client by fd #{}", (int)fd);
+					JLOG_EVERY_T(CRTC, 1000)("eventcb cannot find client by fd #{}", (int)fd);
 				}
 			}
 
@@ -9,9 +9,11 @@
 #include <event2/bufferevent.h>
 #include <event2/listener.h>
 #include <event2/thread.h>
+#include <atomic>
 #include <thread>
 #include <mutex>
 #include <algorithm>
+#include <vector>
 #include <signal.h>
 #include <inttypes.h>
 
@@ -32,12 +34,16 @@
 #  include "../log2micros.h"
 # else
 #  define init_logger(...)
+#  define shutdown_logger(...)
 #  define JLOG_DBUG(...)
 #  define JLOG_INFO(...)
 #  define JLOG_WARN(...)
 #  define JLOG_ERRO(...)
 #  define JLOG_CRTC(...)
 #  define JLOG_ALL(...)
+#  define JLOG_EVERY_N(level, n) if (false) JLOG_##level
+#  define JLOG_FIRST_N(level, n) if (false) JLOG_##level
+#  define JLOG_EVERY_T(level, ms) if (false) JLOG_##level
 
 class range_log {
 public:
@@ -57,11 +63,134 @@ public:
 namespace jlib {
 namespace net {
 
+static int64_t steadyMs()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//! cpu time consumed by the calling thread
+static int64_t threadCpuUs()
+{
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+	if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) {
+		return 0;
+	}
+	auto to100ns = [](const FILETIME& ft) { return ((int64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime; };
+	return (to100ns(kernel) + to100ns(user)) / 10;
+#else
+	timespec ts = {};
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
 struct BaseClientPrivateData {
+	simple_libevent_server* server = nullptr;
 	int thread_id = 0;
 	void* bev = nullptr;
-	void* timer = nullptr;
-	std::chrono::steady_clock::time_point lastTimeComm = {};
+	//! steady clock ms, a plain store so any thread may update it
+	std::atomic<int64_t> lastTimeComm = { 0 };
+	//! links in the worker's idle wheel, slot -1 when not in it
+	simple_libevent_server::BaseClient* wheelPrev = nullptr;
+	simple_libevent_server::BaseClient* wheelNext = nullptr;
+	int wheelSlot = -1;
+};
+
+/**
+* @brief Hashed timing wheel of idle deadlines, one per worker.
+* A client sits in the slot of the deadline it had when last filed; activity only bumps
+* lastTimeComm, the client is refiled lazily when its old slot comes up. A tick touches
+* just the due slot, links are intrusive so nothing is allocated after start.
+*/
+class IdleWheel
+{
+public:
+	typedef simple_libevent_server::BaseClient BaseClient;
+
+	//! slot count covers a full idle period so a deadline never wraps onto the current slot
+	void init(int maxIdleSec, int64_t nowMs) {
+		maxIdleMs_ = (int64_t)maxIdleSec * 1000;
+		slots_.assign((size_t)(maxIdleMs_ / TICK_MS + 2), nullptr);
+		current_ = nowMs / TICK_MS;
+	}
+
+	bool enabled() const { return maxIdleMs_ > 0; }
+
+	void add(BaseClient* client) {
+		auto data = (BaseClientPrivateData*)client->privateData;
+		link(client, deadlineTick(data->lastTimeComm.load(std::memory_order_relaxed)));
+	}
+
+	void remove(BaseClient* client) {
+		auto data = (BaseClientPrivateData*)client->privateData;
+		if (data->wheelSlot < 0) {
+			return;
+		}
+		if (data->wheelPrev) {
+			((BaseClientPrivateData*)data->wheelPrev->privateData)->wheelNext = data->wheelNext;
+		} else {
+			slots_[data->wheelSlot] = data->wheelNext;
+		}
+		if (data->wheelNext) {
+			((BaseClientPrivateData*)data->wheelNext->privateData)->wheelPrev = data->wheelPrev;
+		}
+		data->wheelPrev = data->wheelNext = nullptr;
+		data->wheelSlot = -1;
+	}
+
+	//! advance to nowMs, expired(client) is called for each client idle too long, already out of the wheel
+	template <typename F>
+	void advance(int64_t nowMs, F&& expired) {
+		int64_t target = nowMs / TICK_MS;
+		// after a stall every slot is visited once, that covers all deadlines
+		if (target - current_ > (int64_t)slots_.size()) {
+			current_ = target - (int64_t)slots_.size();
+		}
+		while (current_ < target) {
+			current_++;
+			size_t slot = (size_t)(current_ % (int64_t)slots_.size());
+			BaseClient* client = slots_[slot];
+			slots_[slot] = nullptr;
+			while (client) {
+				auto data = (BaseClientPrivateData*)client->privateData;
+				BaseClient* next = data->wheelNext;
+				data->wheelPrev = data->wheelNext = nullptr;
+				data->wheelSlot = -1;
+				int64_t last = data->lastTimeComm.load(std::memory_order_relaxed);
+				if (nowMs - last >= maxIdleMs_) {
+					expired(client);
+				} else {
+					link(client, deadlineTick(last));
+				}
+				client = next;
+			}
+		}
+	}
+
+	static constexpr int TICK_MS = 100;
+
+private:
+	int64_t deadlineTick(int64_t lastMs) const {
+		// first tick at or after the deadline, never the current one
+		return std::max((lastMs + maxIdleMs_ + TICK_MS - 1) / TICK_MS, current_ + 1);
+	}
+
+	void link(BaseClient* client, int64_t tick) {
+		auto data = (BaseClientPrivateData*)client->privateData;
+		size_t slot = (size_t)(tick % (int64_t)slots_.size());
+		data->wheelSlot = (int)slot;
+		data->wheelPrev = nullptr;
+		data->wheelNext = slots_[slot];
+		if (slots_[slot]) {
+			((BaseClientPrivateData*)slots_[slot]->privateData)->wheelPrev = client;
+		}
+		slots_[slot] = client;
+	}
+
+	int64_t maxIdleMs_ = 0;
+	int64_t current_ = 0;
+	std::vector<BaseClient*> slots_ = {};
 };
 
 
@@ -111,74 +240,221 @@ void simple_libevent_server::BaseClient::shutdown(int what)
 
 void simple_libevent_server::BaseClient::updateLastTimeComm()
 {
-	((BaseClientPrivateData*)privateData)->lastTimeComm = std::chrono::steady_clock::now();
+	((BaseClientPrivateData*)privateData)->lastTimeComm.store(steadyMs(), std::memory_order_relaxed);
 }
 
 struct simple_libevent_server::PrivateImpl
 {
 	struct WorkerThreadContext {
+		simple_libevent_server* server = nullptr;
 		std::string name = {};
 		int thread_id = 0;
-		event_base* base = nullptr;
+		AffinityPolicy affinity = {};
+		//! published by the worker once its loop is set up, start() waits on it
+		std::atomic<event_base*> base = { nullptr };
 		std::thread thread = {};
-
-		static void dummy_timercb_avoid_worker_exit(evutil_socket_t, short, void*)
-		{}
-
-		explicit WorkerThreadContext(const std::string& name, int thread_id)
-			: name(name)
+		//! connections owned by this worker indexed by fd, only touched on the worker thread
+		std::vector<BaseClient*> clients = {};
+		//! idle deadlines of clients, driven by tick, also keeps the loop alive without clients
+		IdleWheel wheel = {};
+		event* tick = nullptr;
+		//! own SO_REUSEPORT listener in reuse port mode
+		evconnlistener* listener = nullptr;
+		//! connections accepted by the listen thread, taken over on wakeup, drained by stop() if never taken
+		std::mutex handOverMutex = {};
+		std::vector<BaseClient*> handOvers = {};
+		event* wakeup = nullptr;
+
+		// load seen by the listen thread, written without locks, own cache line as every accept reads them
+		//! handed over by the listen thread, not yet in clients
+		alignas(64) std::atomic<int> pending = { 0 };
+		//! size of clients minus empty slots
+		std::atomic<int> connections = { 0 };
+		//! cpu time per tick, decaying average over about 8 ticks
+		std::atomic<int64_t> recentCpuUs = { 0 };
+		int64_t lastCpuUs = 0;
+
+		explicit WorkerThreadContext(simple_libevent_server* server, int thread_id)
+			: server(server)
+			, name(server->name_)
 			, thread_id(thread_id)
+			, affinity(server->affinity_)
 		{
+			wheel.init(server->maxIdleTime_, steadyMs());
 			thread = std::thread(&WorkerThreadContext::worker, this);
 		}
 
+		static void tickcb(evutil_socket_t, short, void* user_data)
+		{
+			auto ctx = (WorkerThreadContext*)user_data;
+			int64_t cpu = threadCpuUs();
+			int64_t recent = ctx->recentCpuUs.load(std::memory_order_relaxed);
+			ctx->recentCpuUs.store(recent - recent / 8 + (cpu - ctx->lastCpuUs) / 8, std::memory_order_relaxed);
+			ctx->lastCpuUs = cpu;
+			if (!ctx->wheel.enabled()) {
+				return;
+			}
+			ctx->wheel.advance(steadyMs(), [](BaseClient* client) {
+				auto server = ((BaseClientPrivateData*)client->privateData)->server;
+				JLOG_INFO("{} client #{} idle > {}s, shutting down", server->name_, client->fd, server->maxIdleTime_);
+				client->shutdown();
+			});
+		}
+
 		void worker() {
 			JLOG_INFO("{} WorkerThread #{} started", name.data(), thread_id);
-			base = event_base_new();
-			timeval tv = { 1, 0 };
-			event_add(event_new(base, -1, EV_PERSIST, dummy_timercb_avoid_worker_exit, nullptr), &tv);
-			event_base_dispatch(base);
+			// pin before event_base_new so the base and everything allocated later are node local
+			if (!affinity.apply(thread_id)) {
+				JLOG_WARN("{} WorkerThread #{} failed to apply affinity", name.data(), thread_id);
+			}
+			lastCpuUs = threadCpuUs();
+			auto b = event_base_new();
+			const timeval tv = { 0, IdleWheel::TICK_MS * 1000 };
+			tick = event_new(b, -1, EV_PERSIST, tickcb, this);
+			event_add(tick, &tv);
+			wakeup = event_new(b, -1, EV_PERSIST, handOvercb, this);
+			base = b;
+			event_base_dispatch(b);
 			JLOG_INFO("{} WorkerThread #{} exited", name.data(), thread_id);
 		}
 
+		static WorkerThreadContext* of(BaseClient* client) {
+			auto data = (BaseClientPrivateData*)client->privateData;
+			return data->server->impl->workerThreadContexts[data->thread_id];
+		}
+
+		//! the worker takes over a connection, on the worker thread
+		static void addClient(BaseClient* client)
+		{
+			auto data = (BaseClientPrivateData*)client->privateData;
+			auto server = data->server;
+			auto ctx = of(client);
+			if ((size_t)client->fd >= ctx->clients.size()) {
+				ctx->clients.resize((size_t)client->fd + 1, nullptr);
+			}
+			ctx->clients[client->fd] = client;
+			ctx->connections.fetch_add(1, std::memory_order_relaxed);
+			server->insertClient(client);
+
+			if (ctx->wheel.enabled()) {
+				ctx->wheel.add(client);
+			}
+
+			auto bev = (bufferevent*)data->bev;
+			bufferevent_setcb(bev, readcb, nullptr, eventcb, client);
+			bufferevent_enable(bev, EV_WRITE | EV_READ);
+
+			if (/*server->userData_ && */server->onConn_) {
+				server->onConn_(true, "", client, server->userData_);
+			}
+		}
+
+		//! free a client never taken over, its bufferevent closes the socket
+		static void discardClient(BaseClient* client) {
+			auto bev = (bufferevent*)((BaseClientPrivateData*)client->privateData)->bev;
+			delete client;
+			bufferevent_free(bev);
+		}
+
+		//! forget client and free it with its bufferevent, worker thread only
+		void removeClient(BaseClient* client) {
+			auto data = (BaseClientPrivateData*)client->privateData;
+			wheel.remove(client);
+			data->server->eraseClient(client->fd);
+			clients[client->fd] = nullptr;
+			connections.fetch_sub(1, std::memory_order_relaxed);
+			discardClient(client);
+		}
+
 		static void readcb(struct bufferevent* bev, void* user_data)
 		{
-			char buff[4096];
 			auto input = bufferevent_get_input(bev);
-			simple_libevent_server* server = (simple_libevent_server*)user_data;
+			auto client = (BaseClient*)user_data;
+			simple_libevent_server* server = ((BaseClientPrivateData*)client->privateData)->server;
 			if (/*server->userData_ && */server->onMsg_) {
-				int fd = (int)bufferevent_getfd(bev);
-				BaseClient* client = nullptr;
-				{
-					std::lock_guard<std::mutex> lg(server->mutex);
-					auto iter = server->clients.find(fd);
-					if (iter != server->clients.end()) {
-						client = iter->second;
+				while (1) {
+					size_t avail = evbuffer_get_length(input);
+					if (avail == 0) {
+						break;
 					}
-				}
-				if (client) {
-					while (1) {
-						int len = (int)evbuffer_copyout(input, buff, std::min(sizeof(buff), evbuffer_get_length(input)));
-						if (len > 0) {
-							size_t ate = server->onMsg_(buff, len, client, server->userData_);
-							if (ate > 0) {
-								evbuffer_drain(input, ate);
-								continue;
-							}
-						}
+					// hand over the first chunk in place, no copy
+					evbuffer_iovec chunk = {};
+					if (evbuffer_peek(input, -1, nullptr, &chunk, 1) < 1) {
 						break;
 					}
-				} else {
-					bufferevent_free(bev);
+					const char* data = (const char*)chunk.iov_base;
+					size_t len = chunk.iov_len;
+					size_t ate = server->onMsg_(data, len, client, server->userData_);
+					if (ate == 0 && len < avail && len < server->maxFrameSize_) {
+						// message straddles chunks, make up to maxFrameSize_ bytes contiguous
+						len = std::min(avail, server->maxFrameSize_);
+						data = (const char*)evbuffer_pullup(input, (ev_ssize_t)len);
+						if (!data) {
+							break;
+						}
+						ate = server->onMsg_(data, len, client, server->userData_);
+					}
+					if (ate > 0) {
+						evbuffer_drain(input, std::min(ate, len));
+						continue;
+					}
+					if (len >= server->maxFrameSize_) {
+						JLOG_WARN("{} client #{} message exceeds max frame size {}, shutting down", server->name_, client->fd, server->maxFrameSize_);
+						evbuffer_drain(input, avail);
+						client->shutdown(2);
+					}
+					break;
 				}
 			} else {
 				evbuffer_drain(input, evbuffer_get_length(input));
 			}
 		}
 
-		static void eventcb(struct bufferevent* bev, short events, void* user_data)
+		//! called on the listen thread, queues client for this worker's handOvercb
+		void handOver(BaseClient* client) {
+			pending.fetch_add(1, std::memory_order_relaxed);
+			{
+				std::lock_guard<std::mutex> lg(handOverMutex);
+				handOvers.push_back(client);
+			}
+			event_active(wakeup, EV_TIMEOUT, 0);
+		}
+
+		std::vector<BaseClient*> takeHandOvers() {
+			std::vector<BaseClient*> taken;
+			std::lock_guard<std::mutex> lg(handOverMutex);
+			taken.swap(handOvers);
+			pending.fetch_sub((int)taken.size(), std::memory_order_relaxed);
+			return taken;
+		}
+
+		static void handOvercb(evutil_socket_t, short, void* user_data)
 		{
-			simple_libevent_server* server = (simple_libevent_server*)user_data;
+			auto ctx = (WorkerThreadContext*)user_data;
+			for (auto client : ctx->takeHandOvers()) {
+				addClient(client);
+			}
+		}
+
+		static void accept_cb(evconnlistener* /*listener*/, evutil_socket_t fd, sockaddr* addr, int /*socklen*/, void* user_data)
+		{
+			auto ctx = (WorkerThreadContext*)user_data;
+			auto client = newClient(ctx->server, ctx, fd, addr);
+			addClient(client);
+		}
+
+		static void accept_error_cb(evconnlistener* /*listener*/, void* user_data)
+		{
+			// keep serving accepted clients, libevent keeps the listener armed
+			auto ctx = (WorkerThreadContext*)user_data;
+			int err = EVUTIL_SOCKET_ERROR();
+			JLOG_EVERY_T(CRTC, 1000)("{} WorkerThread #{} accept error:{}:{}", ctx->name.data(), ctx->thread_id, err, evutil_socket_error_to_string(err));
+		}
+
+		static void eventcb(struct bufferevent* /*bev*/, short events, void* user_data)
+		{
+			auto client = (BaseClient*)user_data;
+			simple_libevent_server* server = ((BaseClientPrivateData*)client->privateData)->server;
 			//printf("eventcb events=%d %s\n", events, eventToString(events).data());
 
 			std::string msg;
@@ -188,32 +464,10 @@ struct simple_libevent_server::PrivateImpl
 				msg = ("Got an error on the connection: ");
 				msg += strerror(errno);
 			}
-			int fd = (int)bufferevent_getfd(bev);
-			BaseClient* client = nullptr;
-			{
-				std::lock_guard<std::mutex> lg(server->mutex);
-				auto iter = server->clients.find(fd);
-				if (iter != server->clients.end()) {
-					client = iter->second;
-				} else {
-					JLOG_CRTC("eventcb cannot find client by fd #{}", (int)fd);
-				}
+			if (/*server->userData_ && */server->onConn_) {
+				server->onConn_(false, msg, client, server->userData_);
 			}
-			if (client) {
-				if (((BaseClientPrivateData*)client->privateData)->timer) {
-					event_del((event*)((BaseClientPrivateData*)client->privateData)->timer);
-				}
-				if (/*server->userData_ && */server->onConn_) {
-					server->onConn_(false, msg, client, server->userData_);
-				}
-				{
-					std::lock_guard<std::mutex> lg(server->mutex);
-					server->clients.erase(fd);
-					delete client;
-				}
-			}
-
-			bufferevent_free(bev);
+			of(client)->removeClient(client);
 		}
 	};
 	typedef WorkerThreadContext* WorkerThreadContextPtr;
@@ -225,7 +479,7 @@ struct simple_libevent_server::PrivateImpl
 	event_base* base = nullptr;
 	void* user_data = nullptr;
 	std::thread thread = {};
-	timeval tv = {};
+	evconnlistener* listener = nullptr;
 	WorkerThreadContextPtr* workerThreadContexts = {};
 	int curWorkerId = 0;
 
@@ -238,37 +492,13 @@ struct simple_libevent_server::PrivateImpl
 		event_base_loopexit(base, nullptr);
 	}
 
-	static void timercb(evutil_socket_t fd, short, void* user_data)
-	{
-		auto server = (simple_libevent_server*)user_data;
-		std::lock_guard<std::mutex> lg(server->mutex);
-		auto iter = server->clients.find((int)fd);
-		if (iter != server->clients.end()) {
-			auto client = iter->second;
-			auto now = std::chrono::steady_clock::now();
-			auto diff = std::chrono::duration_cast<std::chrono::seconds>(now - ((BaseClientPrivateData*)client->privateData)->lastTimeComm);
-			if (diff.count() > server->maxIdleTime_) {
-				JLOG_INFO("{} client #{} timeout={}s > {}s, shutting down", server->name_, client->fd, diff.count(), server->maxIdleTime_);
-				((BaseClientPrivateData*)client->privateData)->timer = nullptr;
-				client->shutdown();
-			} else {
-				((BaseClientPrivateData*)client->privateData)->timer = event_new(server->impl->base, fd, 0, timercb, server);
-				event_add((event*)((BaseClientPrivateData*)client->privateData)->timer, &server->impl->tv);
-			}
-		} else {
-			JLOG_CRTC("{} timercb cannot find client by fd #{}", server->name_, (int)fd);
-		}
-	}
-
-	static void accept_cb(evconnlistener* listener, evutil_socket_t fd, sockaddr* addr, int socklen, void* user_data)
+	//! client for an accepted fd with its bufferevent on ctx's base, not yet known to ctx
+	static BaseClient* newClient(simple_libevent_server* server, WorkerThreadContext* ctx, evutil_socket_t fd, sockaddr* addr)
 	{
 		char str[INET_ADDRSTRLEN] = { 0 };
 		auto sin = (sockaddr_in*)addr;
 		inet_ntop(AF_INET, &sin->sin_addr, str, INET_ADDRSTRLEN);
 
-		simple_libevent_server* server = (simple_libevent_server*)user_data;
-		auto ctx = server->impl->workerThreadContexts[server->impl->curWorkerId];
-
 		auto bev = bufferevent_socket_new(ctx->base, fd, BEV_OPT_CLOSE_ON_FREE);
 		if (!bev) {
 			JLOG_CRTC("{} Error constructing bufferevent!", server->name_);
@@ -277,30 +507,89 @@ struct simple_libevent_server::PrivateImpl
 
 		assert(server->newClient_);
 		auto client = server->newClient_((int)fd, bev);
-		((BaseClientPrivateData*)client->privateData)->thread_id = server->impl->curWorkerId;
+		((BaseClientPrivateData*)client->privateData)->thread_id = ctx->thread_id;
+		((BaseClientPrivateData*)client->privateData)->server = server;
 		client->ip = str;
 		client->port = sin->sin_port;
 		client->updateLastTimeComm();
-		((BaseClientPrivateData*)client->privateData)->timer = event_new(ctx->base, fd, 0, timercb, /*new TimerContext({ server, client })*/ server);
-		event_add((event*)((BaseClientPrivateData*)client->privateData)->timer, &server->impl->tv);
+		return client;
+	}
 
-		{
-			std::lock_guard<std::mutex> lg(server->mutex);
-			server->clients[(int)fd] = client;
+	//! listen thread only, scans from curWorkerId so ties rotate
+	int pickWorker(simple_libevent_server* server)
+	{
+		int n = server->threadNum_;
+		int first = curWorkerId;
+		curWorkerId = (curWorkerId + 1) % n;
+		if (server->balance_ == WorkerBalance::roundRobin) {
+			return first;
 		}
 
-		bufferevent_setcb(bev, WorkerThreadContext::readcb, nullptr, WorkerThreadContext::eventcb, server);
-		bufferevent_enable(bev, EV_WRITE | EV_READ);
-
-		if (/*server->userData_ && */server->onConn_) {
-			server->onConn_(true, "", client, server->userData_);
+		auto load = [this](int i) {
+			auto ctx = workerThreadContexts[i];
+			return ctx->connections.load(std::memory_order_relaxed) + ctx->pending.load(std::memory_order_relaxed);
+		};
+		// cpu compared in ms per tick, the sample is stale between ticks and idle workers differ
+		// by noise only, a burst of accepts would all go to one of them without falling back to load
+		auto cpuMs = [this](int i) { return workerThreadContexts[i]->recentCpuUs.load(std::memory_order_relaxed) / 1000; };
+		int best = first;
+		int bestLoad = load(first);
+		int64_t bestCpu = cpuMs(first);
+		for (int k = 1; k < n; k++) {
+			int i = (first + k) % n;
+			int l = load(i);
+			bool better = false;
+			if (server->balance_ == WorkerBalance::leastCpuTime) {
+				int64_t cpu = cpuMs(i);
+				better = cpu < bestCpu || (cpu == bestCpu && l < bestLoad);
+				if (better) { bestCpu = cpu; }
+			} else {
+				better = l < bestLoad;
+			}
+			if (better) {
+				best = i;
+				bestLoad = l;
+			}
 		}
+		return best;
+	}
+
+	static void accept_cb(evconnlistener* /*listener*/, evutil_socket_t fd, sockaddr* addr, int /*socklen*/, void* user_data)
+	{
+		simple_libevent_server* server = (simple_libevent_server*)user_data;
+		auto ctx = server->impl->workerThreadContexts[server->impl->pickWorker(server)];
+		auto client = newClient(server, ctx, fd, addr);
 
-		server->impl->curWorkerId = (server->impl->curWorkerId + 1) % server->threadNum_;
+		// the worker owns the connection from here on, no locking on its read path
+		ctx->handOver(client);
 	}
 
 };
 
+void simple_libevent_server::insertClient(BaseClient* client)
+{
+	auto& shard = clientShards_[(size_t)client->fd % CLIENT_SHARDS];
+	std::lock_guard<std::mutex> lg(shard.mutex);
+	shard.clients[client->fd] = client;
+}
+
+void simple_libevent_server::eraseClient(int fd)
+{
+	auto& shard = clientShards_[(size_t)fd % CLIENT_SHARDS];
+	std::lock_guard<std::mutex> lg(shard.mutex);
+	shard.clients.erase(fd);
+}
+
+size_t simple_libevent_server::clientCount()
+{
+	size_t count = 0;
+	for (auto& shard : clientShards_) {
+		std::lock_guard<std::mutex> lg(shard.mutex);
+		count += shard.clients.size();
+	}
+	return count;
+}
+
 simple_libevent_server::simple_libevent_server()
 {
 	AUTO_LOG_FUNCTION;
@@ -321,42 +610,47 @@ bool simple_libevent_server::start(uint16_t port, std::string& msg)
 
 		std::lock_guard<std::mutex> lg(mutex);
 
-		impl = new PrivateImpl(this);
-		impl->base = event_base_new();
-		if (!impl->base) {
-			msg = name_ + " init libevent failed";
-			JLOG_CRTC(msg);
-			break;
+		bool reusePort = reusePort_;
+#if defined(_WIN32) || !defined(LEV_OPT_REUSEABLE_PORT)
+		if (reusePort) {
+			JLOG_WARN("{} SO_REUSEPORT not supported, falling back to single listener", name_);
+			reusePort = false;
 		}
+#endif
+
+		impl = new PrivateImpl(this);
 
 		sockaddr_in sin = { 0 };
 		sin.sin_family = AF_INET;
 		sin.sin_addr.s_addr = htonl(INADDR_ANY);
 		sin.sin_port = htons(port);
 
-		auto listener = evconnlistener_new_bind(impl->base,
-												PrivateImpl::accept_cb,
-												this,
-												LEV_OPT_REUSEABLE | LEV_OPT_CLOSE_ON_FREE,
-												-1, // backlog, -1 for default
-												(const sockaddr*)(&sin),
-												sizeof(sin));
-		if (!listener) {
-			msg = name_ + " create listener failed";
-			JLOG_CRTC(msg);
-			break;
-		}
-		evconnlistener_set_error_cb(listener, PrivateImpl::accpet_error_cb);
+		if (!reusePort) {
+			impl->base = event_base_new();
+			if (!impl->base) {
+				msg = name_ + " init libevent failed";
+				JLOG_CRTC(msg);
+				break;
+			}
 
-		// init common timeout 
-		impl->tv.tv_sec = maxIdleTime_;
-		impl->tv.tv_usec = 0;
-		const struct timeval* tv_out = event_base_init_common_timeout(impl->base, &impl->tv);
-		memcpy(&impl->tv, tv_out, sizeof(struct timeval));		
+			impl->listener = evconnlistener_new_bind(impl->base,
+													 PrivateImpl::accept_cb,
+													 this,
+													 LEV_OPT_REUSEABLE | LEV_OPT_CLOSE_ON_FREE,
+													 -1, // backlog, -1 for default
+													 (const sockaddr*)(&sin),
+													 sizeof(sin));
+			if (!impl->listener) {
+				msg = name_ + " create listener failed";
+				JLOG_CRTC(msg);
+				break;
+			}
+			evconnlistener_set_error_cb(impl->listener, PrivateImpl::accpet_error_cb);
+		}
 
-		impl->workerThreadContexts = new PrivateImpl::WorkerThreadContextPtr[threadNum_];
+		impl->workerThreadContexts = new PrivateImpl::WorkerThreadContextPtr[threadNum_]();
 		for (int i = 0; i < threadNum_; i++) {
-			impl->workerThreadContexts[i] = (new PrivateImpl::WorkerThreadContext(name_, i));
+			impl->workerThreadContexts[i] = (new PrivateImpl::WorkerThreadContext(this, i));
 		}
 
 		// fix 
@@ -373,11 +667,38 @@ bool simple_libevent_server::start(uint16_t port, std::string& msg)
 			std::this_thread::sleep_for(std::chrono::milliseconds(100));
 		}
 
-		impl->thread = std::thread([this]() {
-			JLOG_INFO("{} listen thread started", name_);
-			event_base_dispatch(this->impl->base);
-			JLOG_INFO("{} listen thread exited", name_);
-		});
+		if (reusePort) {
+#ifdef LEV_OPT_REUSEABLE_PORT
+			// every worker binds the port itself, the kernel spreads connections among them
+			bool listening = true;
+			for (int i = 0; i < threadNum_; i++) {
+				auto ctx = impl->workerThreadContexts[i];
+				ctx->listener = evconnlistener_new_bind(ctx->base,
+														PrivateImpl::WorkerThreadContext::accept_cb,
+														ctx,
+														LEV_OPT_REUSEABLE | LEV_OPT_REUSEABLE_PORT | LEV_OPT_CLOSE_ON_FREE,
+														-1, // backlog, -1 for default
+														(const sockaddr*)(&sin),
+														sizeof(sin));
+				if (!ctx->listener) {
+					listening = false;
+					break;
+				}
+				evconnlistener_set_error_cb(ctx->listener, PrivateImpl::WorkerThreadContext::accept_error_cb);
+			}
+			if (!listening) {
+				msg = name_ + " create reuse port listener failed";
+				JLOG_CRTC(msg);
+				break;
+			}
+#endif
+		} else {
+			impl->thread = std::thread([this]() {
+				JLOG_INFO("{} listen thread started", name_);
+				event_base_dispatch(this->impl->base);
+				JLOG_INFO("{} listen thread exited", name_);
+			});
+		}
 
 		started_ = true;
 		return true;
@@ -403,6 +724,11 @@ void simple_libevent_server::stop()
 		impl->thread.join();
 	}
 
+	if (impl->listener) {
+		evconnlistener_free(impl->listener);
+		impl->listener = nullptr;
+	}
+
 	if (impl->base) {
 		event_base_free(impl->base);
 		impl->base = nullptr;
@@ -417,23 +743,36 @@ void simple_libevent_server::stop()
 
 		for (int i = 0; i < threadNum_; i++) {
 			JLOG_DBUG("simple_libevent_server::stop joining worker #{}", i);
-			impl->workerThreadContexts[i]->thread.join();
-			event_base_free(impl->workerThreadContexts[i]->base);
-			delete impl->workerThreadContexts[i];
+			auto ctx = impl->workerThreadContexts[i];
+			ctx->thread.join();
+			if (ctx->listener) {
+				evconnlistener_free(ctx->listener);
+			}
+			// accepted but not yet taken over, onConn_ never saw them
+			for (auto client : ctx->takeHandOvers()) {
+				PrivateImpl::WorkerThreadContext::discardClient(client);
+			}
+			for (auto client : ctx->clients) {
+				if (client) {
+					if (onConn_) {
+						onConn_(false, "Server stopped", client, userData_);
+					}
+					ctx->removeClient(client);
+				}
+			}
+			event_free(ctx->wakeup);
+			event_free(ctx->tick);
+			event_base_free(ctx->base);
+			delete ctx;
 			JLOG_DBUG("simple_libevent_server::stop joined worker #{}", i);
 		}
 
-		delete impl->workerThreadContexts;
+		delete[] impl->workerThreadContexts;
 	}
 
 	delete impl;
 	impl = nullptr;
 
-	for (auto client : clients) {
-		delete client.second;
-	}
-	clients.clear();
-
 	started_ = false;
 }
 
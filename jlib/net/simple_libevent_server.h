@@ -28,6 +28,7 @@
 #include <unordered_map>
 #include <chrono>
 #include <assert.h>
+#include "../base/affinity.h"
 
 namespace jlib {
 namespace net {
@@ -44,6 +45,7 @@ public:
 		void send(const void* data, size_t len);
 		// 0: recv, 1: send, 2: both
 		void shutdown(int what = 0);
+		//! O(1), safe from any thread
 		void updateLastTimeComm();
 
 		int fd = 0;
@@ -54,10 +56,20 @@ public:
 
 	typedef BaseClient* (*NewClientCallback)(int fd, void* bev);
 
+	//! how the listen thread picks a worker for a new connection
+	enum class WorkerBalance {
+		roundRobin,
+		//! fewest connections, counting ones handed over but not yet taken
+		leastConnections,
+		//! least thread cpu time over the last second or so, ties go to fewer connections
+		leastCpuTime,
+	};
+
 	typedef void(*OnConnectinoCallback)(bool up, const std::string& msg, BaseClient* client, void* user_data);
 
+	// data points into libevent's input buffer, valid only during the call
 	// return > 0 for ate
-	// return 0 for stop
+	// return 0 for stop, called again when more data arrives
 	typedef size_t(*OnMessageCallback)(const char* data, size_t len, BaseClient* client, void* user_data);
 
 
@@ -70,16 +82,68 @@ public:
 	void setName(const std::string& name) { name_ = name; }
 	void setNewClientCallback(NewClientCallback cb) { assert(cb); newClient_ = cb ? cb : BaseClient::createDefaultClient; }
 	void setUserData(void* d) { userData_ = d; }
+	//! up=false also for clients still connected when stop() tears them down, msg "Server stopped"
 	void setOnConnectionCallback(OnConnectinoCallback cb) { onConn_ = cb; }
 	void setOnMsgCallback(OnMessageCallback cb) { onMsg_ = cb; }
+	/**
+	* @brief Shut down clients that have not called updateLastTimeComm() for sec seconds, 0 disables.
+	* Checked by a timing wheel on each worker with 100ms resolution.
+	*/
 	void setClientMaxIdleTime(int sec) { maxIdleTime_ = sec; }
 	void setThreadNum(int threads) { assert(threads >= 1); if (threads >= 1) { threadNum_ = threads; } }
+	/**
+	* @brief Largest message onMsg_ may need to see at once.
+	* Input is handed over in place, only a message straddling libevent chunks is made contiguous,
+	* up to this many bytes. A client whose pending message is larger gets shut down.
+	*/
+	void setMaxFrameSize(size_t bytes) { assert(bytes > 0); if (bytes > 0) { maxFrameSize_ = bytes; } }
+	//! pin worker threads, their event_base and per-connection memory come from the local NUMA node
+	void setAffinityPolicy(const AffinityPolicy& policy) { affinity_ = policy; }
+	/**
+	* @brief Each worker binds the port with SO_REUSEPORT and accepts on its own, no listen thread.
+	* The kernel picks the worker for a connection. Falls back to one listener where unsupported.
+	*/
+	void setReusePort(bool on) { reusePort_ = on; }
+	//! ignored in reuse port mode, the kernel picks the worker there
+	void setWorkerBalance(WorkerBalance balance) { balance_ = balance; }
 
 	// call above functions before start()
 	bool start(uint16_t port, std::string& msg);
 	void stop();
 	bool isStarted() const { return started_; }
 
+	size_t clientCount();
+
+	/**
+	* @brief Call f(client) from any thread while fd stays connected, returns false if it is not.
+	* f runs under a shard lock also taken by connects and disconnects, keep it short.
+	*/
+	template <typename F>
+	bool withClient(int fd, F&& f) {
+		auto& shard = clientShards_[(size_t)fd % CLIENT_SHARDS];
+		std::lock_guard<std::mutex> lg(shard.mutex);
+		auto iter = shard.clients.find(fd);
+		if (iter == shard.clients.end()) {
+			return false;
+		}
+		f(iter->second);
+		return true;
+	}
+
+	/**
+	* @brief Call f(client) for each connected client from any thread, one shard lock held at a time.
+	* A client connecting or leaving meanwhile may or may not be visited, keep f short as in withClient().
+	*/
+	template <typename F>
+	void forEachClient(F&& f) {
+		for (auto& shard : clientShards_) {
+			std::lock_guard<std::mutex> lg(shard.mutex);
+			for (const auto& kv : shard.clients) {
+				f(kv.second);
+			}
+		}
+	}
+
 protected:
 	struct PrivateImpl;
 	PrivateImpl* impl = nullptr;
@@ -97,8 +161,31 @@ protected:
 	//! 工作线程数量
 	int threadNum_ = 1;
 
+	//! 单条消息最大长度
+	size_t maxFrameSize_ = 64 * 1024;
+
+	//! 工作线程绑核策略
+	AffinityPolicy affinity_ = {};
+
+	//! 每个工作线程各自监听
+	bool reusePort_ = false;
+
+	//! 新连接分配工作线程策略
+	WorkerBalance balance_ = WorkerBalance::roundRobin;
+
+	void insertClient(BaseClient* client);
+	void eraseClient(int fd);
+
+	//! guards start/stop
 	std::mutex mutex = {};
-	std::unordered_map<int, BaseClient*> clients = {};
+
+	//! fd -> client for lookups from other threads, workers find their own clients without it
+	struct ClientShard {
+		std::mutex mutex = {};
+		std::unordered_map<int, BaseClient*> clients = {};
+	};
+	static constexpr size_t CLIENT_SHARDS = 16;
+	ClientShard clientShards_[CLIENT_SHARDS] = {};
 };
 
 }
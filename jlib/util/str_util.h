@@ -1,5 +1,6 @@
 ﻿#pragma once
 
+#include "../base/convert.h"
 #include <string>
 #include <algorithm> 
 #include <cctype>
@@ -259,10 +260,8 @@ inline std::wstring center(const std::wstring& str, size_t width, wchar_t fillch
 */
 inline char Dec2Hex(char d)
 {
-	if (0 <= d && d <= 9) {
-		return static_cast<char>((unsigned char)d + (unsigned char)'0');
-	} else if (0x0A <= d && d <= 0x0F) {
-		return char(d - 0x0A + (char)'A');
+	if (0 <= d && d <= 0x0F) {
+		return detail::digitsHex[static_cast<int>(d)];
 	} else {
 		return '0';
 	}
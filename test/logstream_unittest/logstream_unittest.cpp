@@ -1,6 +1,10 @@
 #include "../../jlib/base/logstream.h"
 
 #include <limits>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <stdint.h>
 
 #define BOOST_TEST_MAIN
@@ -182,6 +186,18 @@ BOOST_AUTO_TEST_CASE(testLogStreamVoid)
 	os << reinterpret_cast<void*>(8888);
 	BOOST_CHECK_EQUAL(buf.toString(), string("0x22B8"));
 	os.resetBuffer();
+
+	os << reinterpret_cast<void*>(0xF);
+	BOOST_CHECK_EQUAL(buf.toString(), string("0xF"));
+	os.resetBuffer();
+
+	os << reinterpret_cast<void*>(0x10);
+	BOOST_CHECK_EQUAL(buf.toString(), string("0x10"));
+	os.resetBuffer();
+
+	os << reinterpret_cast<void*>(std::numeric_limits<uintptr_t>::max());
+	BOOST_CHECK_EQUAL(buf.toString(), sizeof(void*) == 8 ? string("0xFFFFFFFFFFFFFFFF") : string("0xFFFFFFFF"));
+	os.resetBuffer();
 }
 
 BOOST_AUTO_TEST_CASE(testLogStreamStrings)
@@ -215,6 +231,40 @@ BOOST_AUTO_TEST_CASE(testLogStreamFmts)
 	os.resetBuffer();
 }
 
+BOOST_AUTO_TEST_CASE(testLogStreamFloatFmts)
+{
+	LogStream os;
+	const LogStream::Buffer& buf = os.buffer();
+
+	os << Format(1.2, 2, FloatFormat::fixed);
+	BOOST_CHECK_EQUAL(buf.toString(), string("1.20"));
+	os.resetBuffer();
+
+	os << Format(-123.456, 4);
+	BOOST_CHECK_EQUAL(buf.toString(), string("-123.5"));
+	os.resetBuffer();
+
+	os << Format(1234.5, 2, FloatFormat::scientific);
+	BOOST_CHECK_EQUAL(buf.toString(), string("1.23e+03"));
+	os.resetBuffer();
+
+	os << Format(0.1 + 0.2, 0, FloatFormat::shortest);
+	BOOST_CHECK_EQUAL(buf.toString(), string("0.30000000000000004"));
+	os.resetBuffer();
+
+	os << 0.1 + 0.2;
+	BOOST_CHECK_EQUAL(buf.toString(), string("0.3"));
+	os.resetBuffer();
+
+	os << 1e300;
+	BOOST_CHECK_EQUAL(buf.toString(), string("1e+300"));
+	os.resetBuffer();
+
+	os << Format(1e300, 2, FloatFormat::fixed);
+	BOOST_CHECK_EQUAL(buf.toString(), string("1.0000000000000001e+300"));
+	os.resetBuffer();
+}
+
 BOOST_AUTO_TEST_CASE(testLogStreamLong)
 {
 	LogStream os;
@@ -234,6 +284,71 @@ BOOST_AUTO_TEST_CASE(testLogStreamLong)
 	BOOST_CHECK_EQUAL(buf.avail(), 87);
 }
 
+BOOST_AUTO_TEST_CASE(testLogStreamOverflow)
+{
+	LogStream os;
+	const LogStream::Buffer& buf = os.buffer();
+	string line(10000, 'x');
+	os << "head " << line << " tail " << 42;
+	BOOST_CHECK_EQUAL(buf.length(), 5 + 10000 + 6 + 2);
+	BOOST_CHECK_EQUAL(buf.toString().substr(10000 + 5), string(" tail 42"));
+
+	string huge(detail::MAX_LOG_LINE * 2, 'y');
+	os << huge;
+	BOOST_CHECK_EQUAL(buf.length(), detail::MAX_LOG_LINE - 1);
+	os << 1;
+	BOOST_CHECK_EQUAL(buf.length(), detail::MAX_LOG_LINE - 1);
+}
+
+BOOST_AUTO_TEST_CASE(testLogStreamNested)
+{
+	LogStream outer;
+	outer << "outer ";
+	{
+		LogStream inner; // thread local storage is taken by outer
+		inner << "inner";
+		BOOST_CHECK_EQUAL(inner.buffer().toString(), string("inner"));
+	}
+	outer << 1;
+	BOOST_CHECK_EQUAL(outer.buffer().toString(), string("outer 1"));
+}
+
+BOOST_AUTO_TEST_CASE(testLogStreamOtherThread)
+{
+	// destroyed after the constructing thread exited
+	std::unique_ptr<LogStream> orphan;
+	std::thread([&orphan]() { orphan.reset(new LogStream()); *orphan << "orphan"; }).join();
+	BOOST_CHECK_EQUAL(orphan->buffer().toString(), string("orphan"));
+	orphan.reset();
+
+	// destroyed here while the constructing thread keeps running, it gets its storage back
+	std::unique_ptr<LogStream> moved;
+	const char* first = nullptr;
+	const char* again = nullptr;
+	bool handed = false, destroyed = false;
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::thread t([&]() {
+		moved.reset(new LogStream());
+		first = moved->buffer().data();
+		std::unique_lock<std::mutex> lock(mutex);
+		handed = true;
+		cond.notify_all();
+		cond.wait(lock, [&]() { return destroyed; });
+		LogStream next;
+		again = next.buffer().data();
+	});
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		cond.wait(lock, [&]() { return handed; });
+		moved.reset();
+		destroyed = true;
+		cond.notify_all();
+	}
+	t.join();
+	BOOST_CHECK(first == again);
+}
+
 BOOST_AUTO_TEST_CASE(testFormatSI)
 {
 	BOOST_CHECK_EQUAL(formatSI(0), string("0"));
@@ -1,6 +1,7 @@
 #include "../../jlib/net/simple_libevent_server.h"
 #include "../../jlib/misc/sudoku.h"
 #include "../../jlib/log2.h"
+#include <algorithm>
 
 using namespace jlib::net;
 using namespace jlib::misc::sudoku;
@@ -45,8 +46,10 @@ size_t onMessageCallback(const char* data, size_t len, simple_libevent_server::B
 {
 	size_t ate = 0;
 	while (len - ate >= 81 + 2) {
-		const char* crlf = strstr(data + ate, "\r\n");
-		if (crlf) {
+		// data is not NUL terminated
+		const char* end = data + len;
+		const char* crlf = std::search(data + ate, end, "\r\n", "\r\n" + 2);
+		if (crlf != end) {
 			std::string request(data + ate, crlf);
 			ate = crlf - data + 2;
 			if (!processRequest(client, request)) {
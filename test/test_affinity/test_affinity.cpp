@@ -0,0 +1,90 @@
+#include "../../jlib/base/affinity.h"
+#include "../../jlib/base/threadpool.h"
+#include "../../jlib/base/countdownlatch.h"
+#include <stdio.h>
+#include <mutex>
+#include <string>
+
+using namespace jlib;
+
+std::string join(const std::vector<int>& ids) {
+	std::string str;
+	for (int id : ids) { str += (str.empty() ? "" : ",") + std::to_string(id); }
+	return str;
+}
+
+int currentCpu() {
+#ifdef JLIB_WINDOWS
+	return static_cast<int>(GetCurrentProcessorNumber());
+#else
+	return sched_getcpu();
+#endif
+}
+
+void showPolicy(const char* name, const AffinityPolicy& policy, int workers) {
+	printf("%-10s", name);
+	for (int i = 0; i < workers; i++) {
+		printf(" #%d:[%s]/n%d", i, join(policy.cpusFor(i)).c_str(), policy.nodeFor(i));
+	}
+	printf("\n");
+}
+
+// each worker reports where it actually runs
+void runPool(const char* name, const AffinityPolicy& policy, int workers) {
+	std::mutex mutex;
+	ThreadPool pool(name);
+	pool.setWorkerInitCallback(policy.workerInitCallback([&mutex, name]() {
+		std::lock_guard<std::mutex> lock(mutex);
+		printf("%s worker running on cpu %d\n", name, currentCpu());
+	}));
+	pool.start(workers);
+	CountDownLatch latch(workers);
+	for (int i = 0; i < workers; i++) { pool.run([&latch]() { latch.countDown(); }); }
+	latch.wait();
+	pool.stop();
+}
+
+// elastic pool grows, retires, grows again: regrown workers reuse slots and their cpus
+void runElastic(const char* name, const AffinityPolicy& policy, int workers) {
+	std::mutex mutex;
+	ThreadPool pool(name);
+	pool.setElastic(workers, std::chrono::milliseconds(20), std::chrono::milliseconds(50));
+	pool.setWorkerInitCallback([&mutex, &policy, name](size_t slot) {
+		policy.apply(static_cast<int>(slot));
+		std::lock_guard<std::mutex> lock(mutex);
+		printf("%s elastic worker slot %zu running on cpu %d, policy [%s]\n", name, slot, currentCpu(),
+			   join(policy.cpusFor(static_cast<int>(slot))).c_str());
+	});
+	pool.start(1);
+	for (int round = 0; round < 2; round++) {
+		CountDownLatch latch(workers * 2);
+		for (int i = 0; i < workers * 2; i++) {
+			pool.run([&latch]() { std::this_thread::sleep_for(std::chrono::milliseconds(50)); latch.countDown(); });
+		}
+		latch.wait();
+		std::this_thread::sleep_for(std::chrono::milliseconds(200)); // back to one worker
+	}
+	pool.stop();
+}
+
+int main()
+{
+	const auto& topology = CpuTopology::instance();
+	printf("%zu cpus, %d nodes\n", topology.cpus.size(), topology.nodeCount);
+	for (const auto& cpu : topology.cpus) {
+		printf("cpu %d node %d core %d\n", cpu.id, cpu.node, cpu.core);
+	}
+	printf("compact [%s]\n", join(topology.compactOrder()).c_str());
+	printf("scatter [%s]\n", join(topology.scatterOrder()).c_str());
+
+	const int workers = 4;
+	showPolicy("none", AffinityPolicy{}, workers);
+	showPolicy("compact", AffinityPolicy{ Affinity::compact }, workers);
+	showPolicy("scatter", AffinityPolicy{ Affinity::scatter }, workers);
+	showPolicy("cpuList", AffinityPolicy{ Affinity::cpuList, { 0 } }, workers);
+	showPolicy("numaNode", AffinityPolicy{ Affinity::numaNode }, workers);
+
+	runPool("compact", AffinityPolicy{ Affinity::compact }, workers);
+	runPool("numaNode", AffinityPolicy{ Affinity::numaNode }, workers);
+	runElastic("scatter", AffinityPolicy{ Affinity::scatter }, workers);
+}
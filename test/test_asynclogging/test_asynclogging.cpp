@@ -0,0 +1,68 @@
+#include "../../jlib/base/logging.h"
+#include "../../jlib/base/asynclogging.h"
+#include <stdio.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+using namespace jlib;
+
+const int N = 1000000;
+const int THREADS = 4;
+
+FILE* g_file = nullptr;
+AsyncLogging* g_asyncLog = nullptr;
+
+void fileOutput(const char* msg, int len) { fwrite(msg, 1, len, g_file); }
+void fileFlush() { fflush(g_file); }
+void asyncOutput(const char* msg, int len) { g_asyncLog->append(msg, len); }
+
+void bench(const char* type)
+{
+	std::vector<std::vector<long long>> latencies(THREADS);
+	std::vector<std::thread> threads;
+	Timestamp start(nowTimestamp());
+	for (int t = 0; t < THREADS; t++) {
+		threads.emplace_back([&latencies, t]() {
+			auto& lat = latencies[t];
+			lat.reserve(N / THREADS);
+			for (int i = 0; i < N / THREADS; i++) {
+				auto begin = std::chrono::steady_clock::now();
+				LOG_INFO << "Hello 0123456789" << " abcdefghijklmnopqrstuvwxyz " << i;
+				auto end = std::chrono::steady_clock::now();
+				lat.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+			}
+		});
+	}
+	for (auto& t : threads) { t.join(); }
+	double seconds = timeDifferenceInS(nowTimestamp(), start);
+
+	std::vector<long long> all;
+	for (auto& lat : latencies) { all.insert(all.end(), lat.begin(), lat.end()); }
+	std::sort(all.begin(), all.end());
+	printf("%-6s %10.0f lines/s, p50 %6lld ns, p99 %6lld ns, p999 %6lld ns\n", type, N / seconds,
+		   all[all.size() / 2], all[all.size() * 99 / 100], all[all.size() * 999 / 1000]);
+}
+
+int main(int argc, char* argv[])
+{
+	const char* filename = argc > 1 ? argv[1] : "test_asynclogging.log";
+	g_file = fopen(filename, "w");
+	if (!g_file) { perror(filename); return 1; }
+
+	Logger::setOutput(fileOutput);
+	Logger::setFlush(fileFlush);
+	bench("sync");
+
+	AsyncLogging log(fileOutput, fileFlush, 1);
+	g_asyncLog = &log;
+	log.start();
+	Logger::setOutput(asyncOutput);
+	bench("async");
+	log.stop();
+	printf("async dropped %llu buffers, %llu bytes\n",
+		   static_cast<unsigned long long>(log.droppedBuffers()),
+		   static_cast<unsigned long long>(log.droppedBytes()));
+
+	fclose(g_file);
+}
@@ -0,0 +1,139 @@
+#include "../../jlib/base/logging.h"
+#include "../../jlib/base/binarylogging.h"
+#include <stdio.h>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace jlib;
+
+const int N = 1000000;
+const int THREADS = 4;
+
+std::vector<std::string> g_lines;
+void collectOutput(const char* msg, int len) { g_lines.emplace_back(msg, len); }
+
+long long g_total = 0;
+void nullOutput(const char*, int len) { g_total += len; }
+
+// drop the timestamp, it's the only difference between the two paths
+std::string stripTime(const std::string& line)
+{
+	auto pos = line.find(") ");
+	return pos == std::string::npos ? line : line.substr(pos + 2);
+}
+
+struct Point { int x, y; };
+LogStream& operator<<(LogStream& s, const Point& p) { return s << '(' << p.x << ',' << p.y << ')'; }
+
+// same line, so __LINE__ matches
+#define LOG_BOTH(LEVEL, args) do { LOG_##LEVEL args; BLOG_##LEVEL args; } while (0)
+
+bool verify()
+{
+	g_lines.clear();
+	Logger::setLogLevel(Logger::LOGLEVEL_TRACE);
+	Logger::setOutput(collectOutput);
+	BinaryLogging::instance().start(10);
+
+	int i = -42; unsigned long long u = 18446744073709551615ULL; double d = 3.1415926;
+	std::string str = "std::string";
+	Point pt{ 1, 2 };
+	LOG_BOTH(TRACE, << "trace " << i);
+	LOG_BOTH(DEBUG, << "debug " << u << ' ' << true);
+	LOG_BOTH(INFO, << "info " << d << ' ' << 1e300 << ' ' << 0.1f << ' ' << (short)-1);
+	LOG_BOTH(WARN, << "warn " << str << ' ' << StringPiece("piece") << ' ' << Format("%06d", 42) << ' ' << (const void*)&i);
+	LOG_BOTH(ERROR, << "error " << pt << ' ' << (const char*)nullptr << 'c');
+
+	BinaryLogging::instance().stop();
+	Logger::setOutput(jlib::detail::defaultOutput);
+	Logger::setLogLevel(Logger::LOGLEVEL_INFO);
+
+	// text lines are written immediately, binary ones by backend after stop
+	bool ok = g_lines.size() == 10;
+	for (size_t j = 0; ok && j < 5; j++) {
+		// g_lines: T0 T1 T2 T3 T4 B0 B1 B2 B3 B4
+		if (stripTime(g_lines[j]) != stripTime(g_lines[j + 5])) {
+			printf("MISMATCH\n  text:   %s  binary: %s", g_lines[j].c_str(), g_lines[j + 5].c_str());
+			ok = false;
+		}
+	}
+	for (const auto& line : g_lines) { printf("%s", line.c_str()); }
+	return ok;
+}
+
+// raw records to file then decoded offline, returns records decoded
+size_t rawSession(const char* filename)
+{
+	FILE* fp = fopen(filename, "wb");
+	if (!fp) { perror(filename); return 0; }
+	BinaryLogging::instance().start(fp);
+	for (int i = 0; i < 1000; i++) {
+		BLOG_INFO << "raw " << i;
+	}
+	BinaryLogging::instance().stop();
+	fclose(fp);
+
+	fp = fopen(filename, "rb");
+	g_total = 0;
+	Timestamp start(nowTimestamp());
+	size_t decoded = BinaryLogging::decode(fp);
+	printf("decoded %zu records, %lld bytes in %.3fms\n", decoded, g_total, timeDifferenceInS(nowTimestamp(), start) * 1000);
+	fclose(fp);
+	return decoded;
+}
+
+template <typename F>
+void bench(const char* type, F&& f)
+{
+	std::vector<std::vector<long long>> latencies(THREADS);
+	std::vector<std::thread> threads;
+	Timestamp start(nowTimestamp());
+	for (int t = 0; t < THREADS; t++) {
+		threads.emplace_back([&latencies, &f, t]() {
+			auto& lat = latencies[t];
+			lat.reserve(N / THREADS);
+			for (int i = 0; i < N / THREADS; i++) {
+				auto begin = std::chrono::steady_clock::now();
+				f(i);
+				auto end = std::chrono::steady_clock::now();
+				lat.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+			}
+		});
+	}
+	for (auto& t : threads) { t.join(); }
+	double seconds = timeDifferenceInS(nowTimestamp(), start);
+
+	std::vector<long long> all;
+	for (auto& lat : latencies) { all.insert(all.end(), lat.begin(), lat.end()); }
+	std::sort(all.begin(), all.end());
+	printf("%-6s %10.0f lines/s, p50 %6lld ns, p99 %6lld ns, p999 %6lld ns\n", type, N / seconds,
+		   all[all.size() / 2], all[all.size() * 99 / 100], all[all.size() * 999 / 1000]);
+}
+
+int main(int argc, char* argv[])
+{
+	if (!verify()) {
+		printf("binary logging output differs from text logging\n");
+		return 1;
+	}
+	printf("binary logging output matches text logging\n");
+
+	Logger::setOutput(nullOutput);
+	bench("text", [](int i) { LOG_INFO << "Hello 0123456789" << " abcdefghijklmnopqrstuvwxyz " << i << ' ' << i * 0.5; });
+
+	// big enough for whole burst, backend formats slower than 4 producers record
+	BinaryLogging::instance().setRingSize(32 * 1024 * 1024);
+	BinaryLogging::instance().start();
+	bench("binary", [](int i) { BLOG_INFO << "Hello 0123456789" << " abcdefghijklmnopqrstuvwxyz " << i << ' ' << i * 0.5; });
+	BinaryLogging::instance().stop();
+	printf("binary dropped %llu records\n", static_cast<unsigned long long>(BinaryLogging::instance().droppedRecords()));
+
+	const char* filename = argc > 1 ? argv[1] : "test_binarylogging.bin";
+	// second file must carry its own site frames for the already registered site
+	if (rawSession(filename) != 1000 || rawSession(filename) != 1000) {
+		printf("raw file lost records\n");
+		return 1;
+	}
+}
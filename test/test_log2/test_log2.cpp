@@ -1,9 +1,46 @@
 #include "../../jlib/log2.h"
+#include <thread>
+#include <vector>
+
+// stdout sink is always on, run with stdout redirected, e.g. test_log2 > nul
+const int N = 100000;
+const int THREADS = 4;
+
+void bench(const char* type)
+{
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+	for (int t = 0; t < THREADS; t++) {
+		threads.emplace_back([]() {
+			for (int i = 0; i < N / THREADS; i++) {
+				JLOG_INFO("Hello 0123456789 abcdefghijklmnopqrstuvwxyz {}", i);
+			}
+		});
+	}
+	for (auto& t : threads) { t.join(); }
+	auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+	jlib::shutdown_logger(); // async: drains queue
+	auto total = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+	fprintf(stderr, "%-6s caller %8.0f lines/s, %6.0f ns/line, drained in %lldms\n", type,
+			N * 1e6 / us, us * 1000.0 / N, static_cast<long long>(total / 1000));
+}
 
 int main()
 {
+#ifdef JLIB_WINDOWS
 	jlib::init_logger(L"test_log2");
+#else
+	jlib::init_logger("test_log2");
+#endif
 	JLOG_INFO("hahaha");
+	bench("sync");
 
+	auto opt = jlib::logger_options::async_default();
+	opt.queue_size = N; // whole burst fits, otherwise callers block at backend speed
+#ifdef JLIB_WINDOWS
+	jlib::init_logger(L"test_log2", opt);
+#else
+	jlib::init_logger("test_log2", opt);
+#endif
+	bench("async");
 }
-
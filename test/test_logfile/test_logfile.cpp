@@ -1,7 +1,42 @@
-//#include "../../jlib/base/logfile.h"
-//#include "../../jlib/base/logging.h"
+#include "../../jlib/base/logfile.h"
+#include "../../jlib/base/logging.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory>
 
-int main()
+using namespace jlib;
+
+std::unique_ptr<LogFile> g_logFile;
+long long g_bytes = 0;
+
+void outputFunc(const char* msg, int len) { g_logFile->append(msg, len); g_bytes += len; }
+void flushFunc() { g_logFile->flush(); }
+
+void bench(bool threadSafe, long long totalBytes)
+{
+	g_logFile.reset(new LogFile("test_logfile", 200 * 1000 * 1000, threadSafe));
+	std::string line = "1234567890 abcdefghijklmnopqrstuvwxyz ABCDEFGHIJKLMNOPQRSTUVWXYZ ";
+
+	long long lines = 0;
+	g_bytes = 0;
+	Timestamp start(nowTimestamp());
+	while (g_bytes < totalBytes) {
+		LOG_INFO << line << lines;
+		lines++;
+	}
+	g_logFile->flush();
+	double seconds = timeDifferenceInS(nowTimestamp(), start);
+	printf("threadSafe=%d %lld lines in %.3fs, %.0f lines/s, %.2f MiB/s\n", threadSafe, lines, seconds,
+		   lines / seconds, g_bytes / seconds / 1024 / 1024);
+	g_logFile.reset();
+}
+
+int main(int argc, char* argv[])
 {
+	long long totalBytes = argc > 1 ? atoll(argv[1]) : 1000LL * 1000 * 1000;
+	Logger::setOutput(outputFunc);
+	Logger::setFlush(flushFunc);
 
+	bench(false, totalBytes);
+	bench(true, totalBytes);
 }
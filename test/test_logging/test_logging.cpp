@@ -1,12 +1,67 @@
-//#include "../../jlib/base/logging.h"
-//#include "../../jlib/base/threadpool.h"
-//#include "../../jlib/base/timezone.h"
+#include "../../jlib/base/logging.h"
+#include <stdio.h>
 
-//using namespace jlib;
+using namespace jlib;
+
+const int N = 1000000;
+
+int g_total = 0;
+void nullOutput(const char*, int len) { g_total += len; }
+
+void benchLogging(const char* name)
+{
+	Logger::setOutput(nullOutput);
+	Timestamp start(nowTimestamp());
+	for (int i = 0; i < N; i++) {
+		LOG_INFO;
+	}
+	Timestamp end(nowTimestamp());
+	Logger::setOutput(jlib::detail::defaultOutput);
+	printf("%-16s %6.1f ns/line\n", name, timeDifference(end, start) * 1000.0 / N);
+}
+
+// what a LOG_INFO costs without formatTime: clock, stream, tid, level, basename
+void benchBaseline()
+{
+	Timestamp start(nowTimestamp());
+	for (int i = 0; i < N; i++) {
+		Timestamp t(nowTimestamp()); (void)t;
+		LogStream stream;
+		stream << "2020-01-01 00:00:00.000000(UTC) " << CurrentThread::tidString() << "INFO  "
+			<< " - " << "test_logging.cpp" << ':' << __LINE__ << '\n';
+		nullOutput(stream.buffer().data(), stream.buffer().length());
+	}
+	Timestamp end(nowTimestamp());
+	printf("%-16s %6.1f ns/line\n", "baseline", timeDifference(end, start) * 1000.0 / N);
+}
+
+void benchDateFormat()
+{
+	std::string str;
+	Timestamp start(nowTimestamp());
+	for (int i = 0; i < N; i++) {
+		str = format("%F %T(%Z) ", nowTimestamp());
+	}
+	Timestamp end(nowTimestamp());
+	printf("%-16s %6.1f ns/line\n", "date::format", timeDifference(end, start) * 1000.0 / N);
+}
+
+// LOG_EVERY_N statement that is suppressed all but once
+void benchEveryN()
+{
+	Logger::setOutput(nullOutput);
+	Timestamp start(nowTimestamp());
+	for (int i = 0; i < N; i++) {
+		LOG_EVERY_N(INFO, N) << "every " << N;
+	}
+	Timestamp end(nowTimestamp());
+	Logger::setOutput(jlib::detail::defaultOutput);
+	printf("%-16s %6.1f ns/line\n", "LOG_EVERY_N", timeDifference(end, start) * 1000.0 / N);
+}
 
 int main()
 {
-	/*Logger::setLogLevel(Logger::LOGLEVEL_TRACE);
+	Logger::setLogLevel(Logger::LOGLEVEL_TRACE);
 
 	LOG_TRACE << "trace";
 	LOG_DEBUG << "debug";
@@ -16,5 +71,20 @@ int main()
 	LOG_INFO << sizeof(Logger);
 	LOG_INFO << sizeof(LogStream);
 	LOG_INFO << sizeof(Format);
-	LOG_INFO << sizeof(LogStream::Buffer);*/
-}
\ No newline at end of file
+	LOG_INFO << sizeof(LogStream::Buffer);
+	printf("%s\n", format("%F %T(%Z) ", nowTimestamp()).c_str());
+	for (int i = 0; i < 10; i++) {
+		LOG_EVERY_N(INFO, 3) << "every 3 #" << i; // 0 3 6 9
+		LOG_FIRST_N(WARN, 2) << "first 2 #" << i; // 0 1
+		LOG_EVERY_T(ERROR, 1000) << "every 1s #" << i; // 0
+	}
+
+	// whole LOG_INFO statement with empty message, formatTime included
+	benchLogging("LOG_INFO utc");
+	Logger::setTimeZone(*locate_zone("Asia/Shanghai"));
+	LOG_INFO << "Asia/Shanghai";
+	benchLogging("LOG_INFO local");
+	benchEveryN();
+	benchBaseline();
+	benchDateFormat();
+}
@@ -1,6 +1,8 @@
 #include "../../jlib/base/logstream.h"
 #include "../../jlib/base/timestamp.h"
 #include <stdio.h>
+#include <algorithm>
+#include <vector>
 
 using namespace jlib;
 
@@ -49,6 +51,118 @@ void benchLogStream()
 	printf("benchLogStream %s\n", format("%S", (end - start)).c_str());
 }
 
+// the digit-per-division converter LogStream used before the lookup table one
+template <typename T>
+size_t convertOld(char buf[], T value)
+{
+	static const char digits[] = "9876543210123456789";
+	static const char* zero = digits + 9;
+	T i = value;
+	char* p = buf;
+	do {
+		int lsd = static_cast<int>(i % 10);
+		i /= 10; *p++ = zero[lsd];
+	} while (i != 0);
+	if (value < 0) { *p++ = '-'; }
+	*p = '\0';
+	std::reverse(buf, p);
+	return p - buf;
+}
+
+size_t convertHexOld(char buf[], uintptr_t value)
+{
+	static const char digitsHex[] = "0123456789ABCDEF";
+	uintptr_t i = value;
+	char* p = buf;
+	do {
+		int lsd = static_cast<int>(i % 16);
+		i /= 16; *p++ = digitsHex[lsd];
+	} while (i != 0);
+	*p = '\0';
+	std::reverse(buf, p);
+	return p - buf;
+}
+
+// values spread over all digit counts
+template <typename T>
+void benchConvert(const char* name)
+{
+	std::vector<T> values;
+	uint64_t x = 88172645463325252ull;
+	for (size_t i = 0; i < 1024; ++i) {
+		x ^= x << 13; x ^= x >> 7; x ^= x << 17; // xorshift
+		values.push_back(static_cast<T>(x >> (x % 64)));
+	}
+
+	char buf[32];
+	size_t total = 0;
+	Timestamp start(nowTimestamp());
+	for (size_t i = 0; i < N; ++i) { total += convertOld(buf, values[i & 1023]); }
+	Timestamp end(nowTimestamp());
+	printf("%s convertOld %s\n", name, format("%S", (end - start)).c_str());
+
+	start = nowTimestamp();
+	for (size_t i = 0; i < N; ++i) { total -= jlib::detail::convert(buf, values[i & 1023]); }
+	end = nowTimestamp();
+	printf("%s convert    %s\n", name, format("%S", (end - start)).c_str());
+
+	start = nowTimestamp();
+	for (size_t i = 0; i < N; ++i) { total += convertHexOld(buf, static_cast<uintptr_t>(values[i & 1023])); }
+	end = nowTimestamp();
+	printf("%s convertHexOld %s\n", name, format("%S", (end - start)).c_str());
+
+	start = nowTimestamp();
+	for (size_t i = 0; i < N; ++i) { total -= jlib::detail::convertHex(buf, static_cast<uintptr_t>(values[i & 1023])); }
+	end = nowTimestamp();
+	printf("%s convertHex    %s\n", name, format("%S", (end - start)).c_str());
+	assert(total == 0); (void)total;
+}
+
+// doubles with fractional parts, (T)(i) only yields integers
+void benchDoubles()
+{
+	char buf[32];
+	double v = 0.0;
+	Timestamp start(nowTimestamp());
+	for (size_t i = 0; i < N; ++i) {
+		v += 1.0 / 7;
+		snprintf(buf, sizeof buf, "%.12g", v);
+	}
+	Timestamp end(nowTimestamp());
+	printf("benchPrintf %s\n", format("%S", (end - start)).c_str());
+
+	LogStream os;
+	v = 0.0;
+	start = nowTimestamp();
+	for (size_t i = 0; i < N; ++i) {
+		v += 1.0 / 7;
+		os << v;
+		os.resetBuffer();
+	}
+	end = nowTimestamp();
+	printf("benchLogStream %s\n", format("%S", (end - start)).c_str());
+
+	v = 0.0;
+	start = nowTimestamp();
+	for (size_t i = 0; i < N; ++i) {
+		v += 1.0 / 7;
+		os << Format(v, 0, FloatFormat::shortest);
+		os.resetBuffer();
+	}
+	end = nowTimestamp();
+	printf("benchLogStream shortest %s\n", format("%S", (end - start)).c_str());
+
+	v = 0.0;
+	start = nowTimestamp();
+	for (size_t i = 0; i < N; ++i) {
+		v += 1.0 / 7;
+		os << Format(v, 3, FloatFormat::fixed);
+		os.resetBuffer();
+	}
+	end = nowTimestamp();
+	printf("benchLogStream fixed3 %s\n", format("%S", (end - start)).c_str());
+}
+
 int main()
 {
 	benchPrintf<int>("%d");
@@ -62,12 +176,19 @@ int main()
 	benchPrintf<double>("%.12g");
 	benchStringStream<double>();
 	benchLogStream<double>();
+	benchDoubles();
 
 	puts("int64_t");
 	benchPrintf<int64_t>("%" PRId64);
 	benchStringStream<int64_t>();
 	benchLogStream<int64_t>();
 
+	puts("convert");
+	benchConvert<int32_t>("int32_t");
+	benchConvert<uint32_t>("uint32_t");
+	benchConvert<int64_t>("int64_t");
+	benchConvert<uint64_t>("uint64_t");
+
 	puts("void*");
 	benchPrintf<void*>("%p");
 	benchStringStream<void*>();
@@ -0,0 +1,122 @@
+#include "../../jlib/base/mpmcqueue.h"
+#include "../../jlib/base/threadpool.h"
+#include "../../jlib/base/timestamp.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace jlib;
+
+const int N = 1000000;
+const size_t CAPACITY = 1024;
+
+// what ThreadPool used for its bounded mode: deque + mutex + notEmpty/notFull
+template <typename T>
+class LockedBoundedQueue
+{
+public:
+	explicit LockedBoundedQueue(size_t capacity) : capacity_(capacity) {}
+
+	void push(T v) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		notFull_.wait(lock, [this]() { return queue_.size() < capacity_; });
+		queue_.push_back(std::move(v));
+		notEmpty_.notify_one();
+	}
+
+	T pop() {
+		std::unique_lock<std::mutex> lock(mutex_);
+		notEmpty_.wait(lock, [this]() { return !queue_.empty(); });
+		T v = std::move(queue_.front());
+		queue_.pop_front();
+		notFull_.notify_one();
+		return v;
+	}
+
+private:
+	size_t capacity_;
+	std::mutex mutex_;
+	std::condition_variable notEmpty_, notFull_;
+	std::deque<T> queue_;
+};
+
+// blocking wrappers spinning on the lock free queue, to compare raw queues
+template <typename T>
+class SpinningMpmcQueue
+{
+public:
+	explicit SpinningMpmcQueue(size_t capacity) : queue_(capacity) {}
+	void push(T v) { while (!queue_.tryPush(v)) { std::this_thread::yield(); } }
+	T pop() { T v; while (!queue_.tryPop(v)) { std::this_thread::yield(); } return v; }
+
+private:
+	BoundedMpmcQueue<T> queue_;
+};
+
+template <typename Queue>
+double benchQueue(int producers, int consumers)
+{
+	Queue queue(CAPACITY);
+	std::atomic<long long> sum(0);
+	std::vector<std::thread> threads;
+	Timestamp start(nowTimestamp());
+	for (int p = 0; p < producers; p++) {
+		threads.emplace_back([&queue, producers]() {
+			for (int i = 0; i < N / producers; i++) { queue.push(i + 1); }
+		});
+	}
+	const int total = N / producers * producers;
+	for (int c = 0; c < consumers; c++) {
+		int count = total / consumers + (c < total % consumers ? 1 : 0);
+		threads.emplace_back([&queue, &sum, count]() {
+			long long local = 0;
+			for (int i = 0; i < count; i++) { local += queue.pop(); }
+			sum += local;
+		});
+	}
+	for (auto& t : threads) { t.join(); }
+	double seconds = timeDifferenceInS(nowTimestamp(), start);
+	return total / seconds;
+}
+
+// whole ThreadPool in bounded mode, producers blocked by backpressure
+double benchPool(int producers, int workers)
+{
+	ThreadPool pool;
+	pool.setMaxQueueSize(CAPACITY);
+	pool.start(workers);
+	std::atomic<int> done(0);
+	std::vector<std::thread> threads;
+	Timestamp start(nowTimestamp());
+	for (int p = 0; p < producers; p++) {
+		threads.emplace_back([&pool, &done, producers]() {
+			for (int i = 0; i < N / producers; i++) { pool.run([&done]() { done.fetch_add(1, std::memory_order_relaxed); }); }
+		});
+	}
+	for (auto& t : threads) { t.join(); }
+	const int total = N / producers * producers;
+	while (done < total) { std::this_thread::yield(); }
+	double seconds = timeDifferenceInS(nowTimestamp(), start);
+	pool.stop();
+	return total / seconds;
+}
+
+int main(int argc, char* argv[])
+{
+	int maxThreads = argc > 1 ? atoi(argv[1]) : 4;
+	printf("items/s, capacity %zu\n", CAPACITY);
+	printf("%9s %9s %14s %14s %14s\n", "producers", "consumers", "mutex+deque", "mpmc", "ThreadPool");
+	for (int p = 1; p <= maxThreads; p *= 2) {
+		for (int c = 1; c <= maxThreads; c *= 2) {
+			printf("%9d %9d %14.0f %14.0f %14.0f\n", p, c,
+				   benchQueue<LockedBoundedQueue<int>>(p, c),
+				   benchQueue<SpinningMpmcQueue<int>>(p, c),
+				   benchPool(p, c));
+		}
+	}
+}
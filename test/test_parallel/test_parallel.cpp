@@ -0,0 +1,134 @@
+#include "../../jlib/base/parallel.h"
+#include "../../jlib/base/convert.h"
+#include "../../jlib/base/timestamp.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace jlib;
+
+bool check(bool ok, const char* what) {
+	printf("%-40s %s\n", what, ok ? "OK" : "FAILED");
+	return ok;
+}
+
+bool testCorrectness(ThreadPool& pool)
+{
+	bool ok = true;
+
+	std::vector<int> v(100003, 0);
+	parallelFor(pool, 0, static_cast<int>(v.size()), 0, [&v](int i) { v[i] += i; });
+	bool each = true;
+	for (int i = 0; i < static_cast<int>(v.size()); i++) { each = each && v[i] == i; }
+	ok &= check(each, "parallelFor visits each index once");
+
+	long long sum = parallelReduce(pool, 0LL, 1000000LL, 1000LL, 0LL,
+								   [](long long first, long long last, long long acc) {
+									   for (long long i = first; i < last; i++) { acc += i; }
+									   return acc;
+								   }, [](long long a, long long b) { return a + b; });
+	ok &= check(sum == 999999LL * 1000000 / 2, "parallelReduce sum");
+
+	// non commutative combine keeps chunk order
+	std::string str = parallelReduce(pool, 0, 26, 3, std::string(),
+									 [](int first, int last, std::string acc) {
+										 for (int i = first; i < last; i++) { acc += static_cast<char>('a' + i); }
+										 return acc;
+									 }, [](std::string a, std::string b) { return a + b; });
+	ok &= check(str == "abcdefghijklmnopqrstuvwxyz", "parallelReduce keeps order");
+
+	ok &= check(parallelReduce(pool, 5, 5, 0, 42, [](int, int, int acc) { return acc; },
+							   [](int a, int b) { return a + b; }) == 42, "empty range returns identity");
+
+	bool caught = false;
+	try {
+		parallelFor(pool, 0, 1000, 1, [](int i) { if (i == 500) { throw std::runtime_error("500"); } });
+	} catch (const std::runtime_error&) {
+		caught = true;
+	}
+	ok &= check(caught, "exception propagates to caller");
+
+	// nested, outer iterations run on pool workers
+	std::atomic<int> inner(0);
+	parallelFor(pool, 0, 8, 1, [&pool, &inner](int) {
+		parallelFor(pool, 0, 100, 10, [&inner](int) { inner++; });
+	});
+	ok &= check(inner == 800, "nested parallelFor");
+
+	return ok;
+}
+
+// every worker nests a parallelFor while the small queue is full, helpers must not block
+bool testNestedBounded()
+{
+	ThreadPool pool;
+	pool.setMaxQueueSize(2);
+	pool.start(3);
+	std::atomic<int> inner(0);
+	parallelFor(pool, 0, 16, 1, [&pool, &inner](int) {
+		parallelFor(pool, 0, 100, 10, [&inner](int) { inner++; });
+	});
+	pool.stop();
+	return check(inner == 1600, "nested parallelFor, bounded queue");
+}
+
+// hex dump a big buffer, each chunk writes its own part of output
+double benchHex(ThreadPool& pool, const std::vector<unsigned char>& data, std::string& out)
+{
+	out.assign(data.size() * 3, ' ');
+	Timestamp start(nowTimestamp());
+	parallelFor(pool, static_cast<size_t>(0), data.size(), static_cast<size_t>(4096), [&data, &out](size_t i) {
+		out[i * 3] = jlib::detail::digitsHex[data[i] >> 4];
+		out[i * 3 + 1] = jlib::detail::digitsHex[data[i] & 0xF];
+	});
+	return timeDifferenceInS(nowTimestamp(), start);
+}
+
+double benchReduce(ThreadPool& pool, const std::vector<double>& data, double& result)
+{
+	Timestamp start(nowTimestamp());
+	result = parallelReduce(pool, static_cast<size_t>(0), data.size(), static_cast<size_t>(0), 0.0,
+							[&data](size_t first, size_t last, double acc) {
+								for (size_t i = first; i < last; i++) { acc += sqrt(data[i]); }
+								return acc;
+							}, [](double a, double b) { return a + b; });
+	return timeDifferenceInS(nowTimestamp(), start);
+}
+
+int main(int argc, char* argv[])
+{
+	int maxThreads = argc > 1 ? atoi(argv[1]) : static_cast<int>(std::thread::hardware_concurrency());
+	if (maxThreads < 1) { maxThreads = 1; }
+
+	ThreadPool pool;
+	pool.start(3);
+	bool ok = testCorrectness(pool);
+	pool.stop();
+	ok &= testNestedBounded();
+
+	std::vector<unsigned char> bytes(64 * 1024 * 1024);
+	for (size_t i = 0; i < bytes.size(); i++) { bytes[i] = static_cast<unsigned char>(i * 2654435761u >> 24); }
+	std::vector<double> doubles(32 * 1024 * 1024);
+	for (size_t i = 0; i < doubles.size(); i++) { doubles[i] = static_cast<double>(i); }
+
+	// pool threads + caller
+	printf("%7s %12s %12s\n", "threads", "hex MB/s", "sqrt-sum M/s");
+	std::string hex;
+	for (int n = 1; ; n *= 2) {
+		if (n > maxThreads) { n = maxThreads; }
+		ThreadPool p;
+		p.start(n - 1);
+		double result = 0;
+		double hexSeconds = benchHex(p, bytes, hex);
+		double reduceSeconds = benchReduce(p, doubles, result);
+		p.stop();
+		printf("%7d %12.0f %12.0f\n", n, bytes.size() / hexSeconds / 1024 / 1024, doubles.size() / reduceSeconds / 1e6);
+		if (n == maxThreads) { break; }
+	}
+
+	return ok ? 0 : 1;
+}
@@ -1,58 +1,477 @@
-//
-//#include "../../jlib/base/logging.h"
-//#include "../../jlib/base/threadpool.h"
-//#include "../../jlib/base/countdownlatch.h"
-//#include "../../jlib/base/currentthread.h"
-//#include "../../jlib/base/process.h"
-//
-//using namespace jlib;
-//using namespace std::chrono;
-//
-//void print() {
-//	printf("tid=%lld\n", CurrentThread::tid());
-//}
-//
-//void printString(const std::string& str) {
-//	LOG_INFO << str;
-//	std::this_thread::sleep_for(100ms);
-//}
-//
-//void test(int maxSize) {
-//	LOG_WARN << "Test ThreadPool with max queue size = " << maxSize;
-//	ThreadPool pool("MainThreadPool");
-//	pool.setMaxQueueSize(maxSize);
-//	pool.start(5);
-//
-//	LOG_WARN << "Adding";
-//	pool.run(print);
-//	pool.run(print);
-//
-//	for (int i = 0; i < 100; i++) {
-//		char buf[32];
-//		snprintf(buf, sizeof(buf), "task %d", i);
-//		pool.run(std::bind(printString, std::string(buf)));
-//	}
-//
-//	LOG_WARN << "Done";
-//
-//	CountDownLatch latch(1);
-//	pool.run(std::bind(&CountDownLatch::countDown, &latch));
-//	latch.wait();
-//	pool.stop();
-//
-//	LOG_WARN << "All Done\n\n";
-//}
-//
-//int main()
-//{
-//	Logger::setLogLevel(Logger::LOGLEVEL_DEBUG);
-//	LOG_INFO << getPid();
-//	//test(0);
-//	//test(1);
-//	//test(5);
-//	//test(10);
-//	test(50);
-//
-//}
-
-int main(){}
\ No newline at end of file
+#include "../../jlib/base/logging.h"
+#include "../../jlib/base/threadpool.h"
+#include "../../jlib/base/countdownlatch.h"
+#include "../../jlib/base/currentthread.h"
+#include "../../jlib/base/process.h"
+#include <algorithm>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace jlib;
+using namespace std::chrono;
+
+static int g_failures = 0;
+
+const char* result(bool ok) {
+	if (!ok) { g_failures++; }
+	return ok ? "OK" : "FAILED";
+}
+
+void print() {
+	printf("tid=%llu\n", static_cast<unsigned long long>(CurrentThread::tid()));
+}
+
+void printString(const std::string& str) {
+	LOG_INFO << str;
+	std::this_thread::sleep_for(10ms);
+}
+
+void test(int maxSize) {
+	LOG_WARN << "Test ThreadPool with max queue size = " << maxSize;
+	ThreadPool pool("MainThreadPool");
+	pool.setMaxQueueSize(maxSize);
+	pool.start(5);
+
+	LOG_WARN << "Adding";
+	pool.run(print);
+	pool.run(print);
+
+	for (int i = 0; i < 100; i++) {
+		char buf[32];
+		snprintf(buf, sizeof(buf), "task %d", i);
+		pool.run(std::bind(printString, std::string(buf)));
+	}
+
+	LOG_WARN << "Done";
+
+	CountDownLatch latch(1);
+	pool.run(std::bind(&CountDownLatch::countDown, &latch));
+	latch.wait();
+	pool.stop();
+
+	LOG_WARN << "All Done\n\n";
+}
+
+// tasks owning move-only resources
+void testMoveOnly() {
+	ThreadPool pool("MoveOnlyPool");
+	pool.start(2);
+	const int n = 100;
+	CountDownLatch latch(n);
+	std::atomic<int> sum(0);
+	for (int i = 0; i < n; i++) {
+		std::unique_ptr<int> value(new int(i));
+		std::vector<char> buffer(1024, 'x');
+		pool.run([value = std::move(value), buffer = std::move(buffer), &sum, &latch]() {
+			sum += *value + static_cast<int>(buffer.size()) - 1024;
+			latch.countDown();
+		});
+	}
+	latch.wait();
+	pool.stop();
+	LOG_WARN << "move-only tasks sum=" << sum.load() << " " << result(sum == n * (n - 1) / 2);
+}
+
+void testSubmit() {
+	ThreadPool pool("SubmitPool");
+	pool.start(4);
+	auto f1 = pool.submit([]() { return 6 * 7; });
+	auto f2 = pool.submit([]() { return std::string("hello"); });
+	auto f3 = pool.submit([]() -> int { throw std::runtime_error("oops"); });
+	auto f4 = pool.submit([]() {});
+	bool caught = false;
+	try { f3.get(); } catch (const std::runtime_error&) { caught = true; }
+	f4.get();
+	bool ok = f1.get() == 42 && f2.get() == "hello" && caught;
+
+	std::vector<std::function<int()>> jobs;
+	for (int i = 0; i < 100; i++) { jobs.emplace_back([i]() { return i; }); }
+	auto futures = pool.submitBatch(jobs);
+	int sum = 0;
+	for (auto& f : futures) { sum += f.get(); }
+	ok = ok && sum == 4950;
+
+	// returning a reference
+	int value = 1;
+	auto fr = pool.submit([&value]() -> int& { return value; });
+	ok = ok && &fr.get() == &value;
+	pool.stop();
+	LOG_WARN << "submit " << result(ok);
+}
+
+void testBrokenPromise(size_t maxQueueSize) {
+	ThreadPool pool("BrokenPromisePool");
+	pool.setMaxQueueSize(maxQueueSize);
+	pool.start(1);
+	CountDownLatch started(1);
+	pool.run([&started]() { started.countDown(); std::this_thread::sleep_for(100ms); });
+	started.wait();
+	auto queued = pool.submit([]() { return 42; });
+	pool.stop(); // discards queued
+	bool broken = false;
+	try {
+		queued.get();
+	} catch (const std::future_error& e) {
+		broken = e.code() == std::future_errc::broken_promise;
+	}
+	LOG_WARN << "broken promise maxQueueSize=" << maxQueueSize << " " << result(broken);
+}
+
+void printHistogram(const char* name, const HistogramSnapshot& h) {
+	printf("%-10s count=%llu mean=%.0f p50=%llu p99=%llu max=%llu\n", name,
+		   (unsigned long long)h.count, h.mean(), (unsigned long long)h.percentile(50),
+		   (unsigned long long)h.percentile(99), (unsigned long long)h.max);
+}
+
+void testMetrics() {
+	ThreadPool pool("MetricsPool");
+	pool.setMetricsEnabled(true);
+	pool.setMaxQueueSize(4);
+	pool.start(2);
+	CountDownLatch started(2), latch(1);
+	for (int i = 0; i < 2; i++) { pool.run([&started, &latch]() { started.countDown(); latch.wait(); }); }
+	started.wait(); // both workers busy, queue of 4 empty
+	int rejected = 0;
+	for (int i = 0; i < 10; i++) {
+		ThreadPool::Task task([]() { std::this_thread::sleep_for(1ms); });
+		if (!pool.tryRun(task)) { rejected++; }
+	}
+	latch.countDown();
+	for (int i = 0; i < 100; i++) { pool.run([]() { std::this_thread::sleep_for(100us); }); }
+	auto live = pool.metrics(); // while workers are busy
+	while (pool.metrics().runTime.count < static_cast<uint64_t>(102 + 10 - rejected)) { std::this_thread::sleep_for(1ms); }
+	auto m = pool.metrics();
+	pool.stop();
+
+	printf("queue=%zu blocked=%llu rejected=%llu\n", m.queueSize, (unsigned long long)m.blocked, (unsigned long long)m.rejected);
+	printHistogram("wait ns", m.queueWait);
+	printHistogram("run ns", m.runTime);
+	printHistogram("depth", m.queueDepth);
+	for (size_t i = 0; i < m.busyRatio.size(); i++) { printf("worker %zu busy %.0f%%\n", i, m.busyRatio[i] * 100); }
+	bool ok = rejected == 6 && m.rejected == 6u && live.busyRatio.size() == 2 && m.runTime.percentile(99) >= 100000;
+	LOG_WARN << "metrics " << result(ok);
+}
+
+void testTimers() {
+	ThreadPool pool("TimerPool");
+	pool.start(2);
+	std::mutex mutex;
+	std::vector<int> order;
+	auto record = [&mutex, &order](int i) { std::lock_guard<std::mutex> lock(mutex); order.push_back(i); };
+	pool.runAfter(30ms, [record]() { record(3); });
+	pool.runAfter(10ms, [record]() { record(1); });
+	pool.runAfter(20ms, [record]() { record(2); });
+	auto cancelled = pool.runAfter(15ms, [record]() { record(-1); });
+	bool cancelOk = pool.cancel(cancelled) && !pool.cancel(cancelled);
+
+	std::atomic<int> ticks(0);
+	auto every = pool.runEvery(5ms, [&ticks]() { ticks++; });
+	std::this_thread::sleep_for(60ms);
+	pool.cancel(every);
+	int ticksAtCancel = ticks;
+	std::this_thread::sleep_for(20ms);
+
+	// periodic timer cancelling itself
+	std::atomic<int> selfTicks(0);
+	TimerId self;
+	std::mutex selfMutex;
+	{
+		std::lock_guard<std::mutex> lock(selfMutex);
+		self = pool.runEvery(1ms, [&]() {
+			std::lock_guard<std::mutex> lock(selfMutex);
+			if (++selfTicks == 3) { pool.cancel(self); }
+		});
+	}
+	std::this_thread::sleep_for(20ms);
+	pool.stop();
+
+	bool ok = cancelOk && order == std::vector<int>({ 1, 2, 3 }) && ticksAtCancel >= 5
+		&& ticks <= ticksAtCancel + 1 && selfTicks == 3;
+	LOG_WARN << "timers ticks=" << ticksAtCancel << " " << result(ok);
+}
+
+// full bounded queue: an expired timer waits for room without blocking the timer thread,
+// stop() returns while a producer is blocked in run() and a worker schedules timers
+void testTimersFullQueue() {
+	ThreadPool pool("FullTimerPool");
+	pool.setMaxQueueSize(1);
+	pool.start(1);
+	CountDownLatch started(1), latch(1);
+	pool.run([&]() { started.countDown(); latch.wait(); });
+	started.wait();
+	pool.run([]() {}); // queue full
+	std::atomic<int> fired(0);
+	pool.runAfter(1ms, [&fired]() { fired++; });
+	auto early = pool.runAfter(1ms, [&fired]() { fired += 100; });
+	std::this_thread::sleep_for(20ms);
+	bool cancelOk = pool.cancel(early); // still waiting for room
+	latch.countDown();
+	while (fired == 0) { std::this_thread::sleep_for(1ms); }
+	std::this_thread::sleep_for(20ms);
+
+	CountDownLatch blocking(1);
+	pool.run([&]() {
+		blocking.countDown();
+		std::this_thread::sleep_for(50ms);
+		pool.runAfter(1ms, []() {}); // timer mutex taken while stop() runs
+	});
+	blocking.wait();
+	pool.run([]() {}); // queue full again
+	std::thread producer([&pool]() { pool.run([]() {}); }); // blocks until stop
+	std::this_thread::sleep_for(10ms);
+	pool.stop();
+	producer.join();
+	bool ok = cancelOk && fired == 1;
+	LOG_WARN << "timers full queue fired=" << fired.load() << " " << result(ok);
+}
+
+// blocking tasks stall a small pool, it grows, then shrinks back when idle
+void testElastic(size_t maxQueueSize) {
+	ThreadPool pool("ElasticPool");
+	pool.setMaxQueueSize(maxQueueSize);
+	pool.setElastic(4, 20ms, 100ms);
+	pool.setMetricsEnabled(true);
+	pool.start(1);
+	std::atomic<int> done(0);
+	for (int i = 0; i < 8; i++) {
+		pool.run([&done]() { std::this_thread::sleep_for(100ms); done++; });
+	}
+	size_t peak = 0;
+	while (done < 8) {
+		peak = std::max(peak, pool.threadCount());
+		std::this_thread::sleep_for(5ms);
+	}
+	std::this_thread::sleep_for(300ms);
+	size_t after = pool.threadCount();
+	auto counted = pool.metrics().runTime.count; // retired workers' tasks included
+	pool.run([&done]() { done++; }); // retired slots are reusable
+	while (done < 9) { std::this_thread::sleep_for(1ms); }
+	pool.stop();
+	bool ok = peak == 4 && after == 1 && counted == 8;
+	LOG_WARN << "elastic queue=" << maxQueueSize << " peak=" << peak << " after idle=" << after << " counted=" << counted << " " << result(ok);
+}
+
+// bounded elastic pool filled with blocking tasks, with a timer waiting for room, still grows
+void testElasticFull() {
+	ThreadPool pool("ElasticFullPool");
+	pool.setMaxQueueSize(2);
+	pool.setElastic(4, 20ms, 100ms);
+	pool.start(1);
+	CountDownLatch latch(1);
+	for (int i = 0; i < 3; i++) { pool.run([&latch]() { latch.wait(); }); } // one running, queue full
+	auto tick = pool.runEvery(1ms, []() {});
+	size_t grown = 0;
+	for (int i = 0; i < 100 && grown < 3; i++) {
+		std::this_thread::sleep_for(5ms);
+		grown = pool.threadCount();
+	}
+	latch.countDown();
+	pool.cancel(tick);
+	pool.stop();
+	LOG_WARN << "elastic full queue grown=" << grown << " " << result(grown >= 3);
+}
+
+// pool saturated by bulk jobs in the low lane, how long do high lane tasks wait to start
+int64_t highLaneMaxWaitUs(size_t lanes, ThreadPool::LanePolicy policy) {
+	ThreadPool pool("LanePool");
+	pool.setPriorityLanes(lanes, policy);
+	pool.start(2);
+	for (int i = 0; i < 300; i++) {
+		pool.run([]() { std::this_thread::sleep_for(2ms); }, lanes - 1);
+	}
+	std::atomic<int64_t> maxWait(0);
+	CountDownLatch latch(20);
+	for (int i = 0; i < 20; i++) {
+		auto queued = steady_clock::now();
+		pool.run([queued, &maxWait, &latch]() {
+			int64_t wait = duration_cast<microseconds>(steady_clock::now() - queued).count();
+			if (wait > maxWait) { maxWait = wait; }
+			latch.countDown();
+		}, 0);
+		std::this_thread::sleep_for(10ms);
+	}
+	latch.wait();
+	pool.stop();
+	return maxWait;
+}
+
+// one worker, both lanes full: share of the first 400 runs taken by lane 0
+double weightedShare(size_t maxQueueSize) {
+	ThreadPool pool("WeightedPool");
+	pool.setMaxQueueSize(maxQueueSize);
+	pool.setPriorityLanes(2, ThreadPool::LanePolicy::weighted, { 3, 1 });
+	pool.start(1);
+	CountDownLatch started(1), latch(1);
+	pool.run([&]() { started.countDown(); latch.wait(); });
+	started.wait();
+	std::vector<int> order;
+	for (int i = 0; i < 400; i++) {
+		pool.run([&order]() { order.push_back(0); }, 0);
+		pool.run([&order]() { order.push_back(1); }, 1);
+	}
+	latch.countDown();
+	CountDownLatch done(1);
+	pool.run([&done]() { done.countDown(); }, 1);
+	done.wait();
+	pool.stop();
+	return std::count(order.begin(), order.begin() + 400, 0) / 400.0;
+}
+
+void testPriorityLanes() {
+	int64_t fifo = highLaneMaxWaitUs(1, ThreadPool::LanePolicy::strict);
+	int64_t strict = highLaneMaxWaitUs(2, ThreadPool::LanePolicy::strict);
+	int64_t weighted = highLaneMaxWaitUs(2, ThreadPool::LanePolicy::weighted);
+	double share = weightedShare(0), boundedShare = weightedShare(512);
+	printf("high lane max wait: fifo %lldus, strict %lldus, weighted %lldus\n", (long long)fifo, (long long)strict, (long long)weighted);
+	printf("weighted 3:1 share of lane 0: %.2f, bounded %.2f\n", share, boundedShare);
+	// a high lane task waits at most for a running bulk task to finish
+	bool ok = strict < 10000 && weighted < 10000 && fifo > 50000
+		&& share > 0.7 && share < 0.8 && boundedShare > 0.7 && boundedShare < 0.8;
+	LOG_WARN << "priority lanes " << result(ok);
+}
+
+// heap cost: schedule and cancel many far timers
+void benchTimers() {
+	const int N = 1000000;
+	TimerQueue timers;
+	std::vector<TimerId> ids;
+	ids.reserve(N);
+	Timestamp start(nowTimestamp());
+	for (int i = 0; i < N; i++) { ids.push_back(timers.runAfter(std::chrono::seconds(60 + i % 1000), []() {})); }
+	double addNs = timeDifference(nowTimestamp(), start) * 1000.0 / N;
+	start = nowTimestamp();
+	for (auto id : ids) { timers.cancel(id); }
+	double cancelNs = timeDifference(nowTimestamp(), start) * 1000.0 / N;
+	printf("%-16s %6.1f ns/timer, cancel %6.1f ns/timer\n", "runAfter", addNs, cancelNs);
+}
+
+// cost of metrics on tiny tasks
+void benchMetrics() {
+	const int N = 1000000;
+	for (int enabled = 0; enabled < 2; enabled++) {
+		ThreadPool pool;
+		pool.setMetricsEnabled(enabled != 0);
+		pool.start(4);
+		std::atomic<int> done(0);
+		Timestamp start(nowTimestamp());
+		for (int i = 0; i < N; i++) { pool.run([&done]() { done++; }); }
+		while (done < N) { std::this_thread::yield(); }
+		double ns = timeDifference(nowTimestamp(), start) * 1000.0 / N;
+		pool.stop();
+		printf("%-16s %6.1f ns/task\n", enabled ? "run+metrics" : "run", ns);
+	}
+}
+
+// fan-out bursts: one run() per task vs one runBatch() per burst
+void benchBatch() {
+	const int BURSTS = 100, BURST = 10000;
+	std::atomic<int> done(0);
+	for (int batch = 0; batch < 2; batch++) {
+		ThreadPool pool;
+		pool.start(4);
+		done = 0;
+		Timestamp start(nowTimestamp());
+		for (int b = 0; b < BURSTS; b++) {
+			if (batch) {
+				std::vector<ThreadPool::Task> tasks;
+				tasks.reserve(BURST);
+				for (int i = 0; i < BURST; i++) { tasks.emplace_back([&done]() { done++; }); }
+				pool.runBatch(tasks.begin(), tasks.end());
+			} else {
+				for (int i = 0; i < BURST; i++) { pool.run([&done]() { done++; }); }
+			}
+		}
+		while (done < BURSTS * BURST) { std::this_thread::yield(); }
+		double ns = timeDifference(nowTimestamp(), start) * 1000.0 / (BURSTS * BURST);
+		pool.stop();
+		printf("%-16s %6.1f ns/task\n", batch ? "runBatch" : "run", ns);
+	}
+
+	ThreadPool pool;
+	pool.start(4);
+	Timestamp start(nowTimestamp());
+	long long sum = 0;
+	for (int b = 0; b < BURSTS / 10; b++) {
+		std::vector<std::function<int()>> jobs;
+		for (int i = 0; i < BURST; i++) { jobs.emplace_back([i]() { return i; }); }
+		for (auto& f : pool.submitBatch(jobs)) { sum += f.get(); }
+	}
+	printf("%-16s %6.1f ns/task\n", "submitBatch+get", timeDifference(nowTimestamp(), start) * 1000.0 / (BURSTS / 10 * BURST));
+
+	pool.stop();
+
+	// future overhead without thread handoff, a pool without threads runs tasks in caller
+	ThreadPool inlinePool;
+	inlinePool.start(0);
+	const int N = 1000000;
+	start = nowTimestamp();
+	for (int i = 0; i < N; i++) { sum += inlinePool.submit([i]() { return i; }).get(); }
+	printf("%-16s %6.1f ns/task\n", "submit+get", timeDifference(nowTimestamp(), start) * 1000.0 / N);
+	start = nowTimestamp();
+	for (int i = 0; i < N; i++) {
+		std::promise<int> promise;
+		auto future = promise.get_future();
+		inlinePool.run([promise = std::move(promise), i]() mutable { promise.set_value(i); });
+		sum += future.get();
+	}
+	printf("%-16s %6.1f ns/task\n", "std::promise+get", timeDifference(nowTimestamp(), start) * 1000.0 / N);
+}
+
+// counts heap allocations to show inline storage
+static std::atomic<long long> g_allocs(0);
+// every scalar and array form replaced, so no pointer crosses to the library's own delete
+static void* countedAlloc(size_t size) { g_allocs++; void* p = malloc(size ? size : 1); if (!p) { throw std::bad_alloc(); } return p; }
+void* operator new(size_t size) { return countedAlloc(size); }
+void* operator new[](size_t size) { return countedAlloc(size); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+template <typename Function>
+void benchTask(const char* name) {
+	const int N = 1000000;
+	char payload[32] = {}; // larger than std::function small buffer, fits UniqueFunction inline
+	long long sum = 0;
+	long long allocs = g_allocs;
+	Timestamp start(nowTimestamp());
+	for (int i = 0; i < N; i++) {
+		Function f([payload, i, &sum]() { sum += payload[i % sizeof(payload)] + i; });
+		Function g(std::move(f));
+		g();
+	}
+	double ns = timeDifference(nowTimestamp(), start) * 1000.0 / N;
+	printf("%-16s %6.1f ns/task, %.2f allocs/task, sum=%lld\n", name, ns, (g_allocs - allocs) * 1.0 / N, sum);
+}
+
+int main()
+{
+	Logger::setLogLevel(Logger::LOGLEVEL_DEBUG);
+	LOG_INFO << getPid();
+	test(0);
+	test(1);
+	test(5);
+	test(10);
+	test(50);
+	testMoveOnly();
+	testSubmit();
+	testBrokenPromise(0);
+	testBrokenPromise(16);
+	testMetrics();
+	testTimers();
+	testTimersFullQueue();
+	testElastic(0);
+	testElastic(16);
+	testElasticFull();
+	testPriorityLanes();
+	benchMetrics();
+	benchTimers();
+	benchBatch();
+
+	printf("sizeof(std::function)=%zu sizeof(ThreadPool::Task)=%zu\n", sizeof(std::function<void()>), sizeof(ThreadPool::Task));
+	benchTask<std::function<void()>>("std::function");
+	benchTask<ThreadPool::Task>("ThreadPool::Task");
+	return g_failures ? 1 : 0;
+}
@@ -0,0 +1,78 @@
+#include "../../jlib/base/threadpool.h"
+#include "../../jlib/base/workstealingpool.h"
+#include "../../jlib/base/timestamp.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <thread>
+
+using namespace jlib;
+
+const int N = 1000000;
+std::atomic<int> g_done;
+
+void tinyTask() { g_done.fetch_add(1, std::memory_order_relaxed); }
+
+void waitDone(int n) {
+	while (g_done.load(std::memory_order_acquire) < n) { std::this_thread::yield(); }
+}
+
+// all tasks submitted from main thread
+template <typename Pool>
+double benchExternal(int nThreads)
+{
+	Pool pool;
+	pool.start(nThreads);
+	g_done = 0;
+	Timestamp start(nowTimestamp());
+	for (int i = 0; i < N; i++) {
+		pool.run(tinyTask);
+	}
+	waitDone(N);
+	double seconds = timeDifferenceInS(nowTimestamp(), start);
+	pool.stop();
+	return N / seconds;
+}
+
+// binary tree of tasks, each spawns two children from inside the pool
+template <typename Pool>
+void spawn(Pool* pool, int depth) {
+	tinyTask();
+	if (depth > 0) {
+		pool->run([pool, depth]() { spawn(pool, depth - 1); });
+		pool->run([pool, depth]() { spawn(pool, depth - 1); });
+	}
+}
+
+template <typename Pool>
+double benchForkJoin(int nThreads)
+{
+	const int depth = 19; // 2^20 - 1 tasks
+	const int total = (1 << (depth + 1)) - 1;
+	Pool pool;
+	pool.start(nThreads);
+	g_done = 0;
+	Timestamp start(nowTimestamp());
+	Pool* p = &pool;
+	pool.run([p]() { spawn(p, depth); });
+	waitDone(total);
+	double seconds = timeDifferenceInS(nowTimestamp(), start);
+	pool.stop();
+	return total / seconds;
+}
+
+int main(int argc, char* argv[])
+{
+	int maxThreads = argc > 1 ? atoi(argv[1]) : static_cast<int>(std::thread::hardware_concurrency());
+	if (maxThreads < 1) { maxThreads = 1; }
+
+	printf("tiny tasks/s, %d cores\n", static_cast<int>(std::thread::hardware_concurrency()));
+	printf("%7s %14s %14s %14s %14s\n", "threads", "TP external", "WSP external", "TP fork-join", "WSP fork-join");
+	for (int n = 1; ; n *= 2) {
+		if (n > maxThreads) { n = maxThreads; }
+		printf("%7d %14.0f %14.0f %14.0f %14.0f\n", n,
+			   benchExternal<ThreadPool>(n), benchExternal<WorkStealingPool>(n),
+			   benchForkJoin<ThreadPool>(n), benchForkJoin<WorkStealingPool>(n));
+		if (n == maxThreads) { break; }
+	}
+}